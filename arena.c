@@ -0,0 +1,94 @@
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ALIGN alignof(max_align_t)
+#define ROUND(n) (((n) + ALIGN - 1) & ~(ALIGN - 1))
+#define MIN_CHUNK 1024
+
+/**
+ * new_chunk - 分配一个可以容纳 size 字节的块
+ */
+static struct arena_chunk *new_chunk(size_t size) {
+    struct arena_chunk *chunk = (struct arena_chunk *)malloc(sizeof(struct arena_chunk) + size);
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+/**
+ * arena_new - 创建内存池，hint 为预计需要的字节数，
+ * 内存池本身的结构体也放在第一个块中
+ */
+struct arena *arena_new(size_t hint) {
+    size_t size = ROUND(sizeof(struct arena)) + ROUND(hint);
+    struct arena_chunk *chunk = new_chunk(size < MIN_CHUNK ? MIN_CHUNK : size);
+    struct arena *a = (struct arena *)chunk->data;
+    chunk->used = ROUND(sizeof(struct arena));
+    a->head = chunk;
+    return a;
+}
+
+/**
+ * arena_alloc - 从内存池中分配 n 字节，当前块不够时分配一个新的块
+ */
+void *arena_alloc(struct arena *a, size_t n) {
+    struct arena_chunk *chunk = a->head;
+    n = ROUND(n);
+    if (chunk->size - chunk->used < n) {
+        size_t size = chunk->size * 2;
+        chunk = new_chunk(size < n ? n : size);
+        chunk->next = a->head;
+        a->head = chunk;
+    }
+    void *p = chunk->data + chunk->used;
+    chunk->used += n;
+    return p;
+}
+
+/**
+ * arena_strndup - 复制 s 的前 n 个字符，并以 '\0' 结尾
+ */
+char *arena_strndup(struct arena *a, const char *s, size_t n) {
+    char *p = (char *)arena_alloc(a, n + 1);
+    memcpy(p, s, n);
+    p[n] = '\0';
+    return p;
+}
+
+/**
+ * arena_strdup - 复制字符串 s
+ */
+char *arena_strdup(struct arena *a, const char *s) {
+    return arena_strndup(a, s, strlen(s));
+}
+
+/**
+ * arena_reset - 释放之后分配的块，只保留内存池结构体所在的第一个块，
+ * 之前分配的内存全部失效，用于反复分配临时数据
+ */
+void arena_reset(struct arena *a) {
+    struct arena_chunk *chunk = a->head, *next;
+    while (chunk->next) {
+        next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    chunk->used = ROUND(sizeof(struct arena));
+    a->head = chunk;
+}
+
+/**
+ * arena_free - 释放整个内存池，内存池的结构体位于最早的块中，因此最后释放
+ */
+void arena_free(struct arena *a) {
+    struct arena_chunk *chunk = a->head, *next;
+    while (chunk) {
+        next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+}
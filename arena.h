@@ -0,0 +1,28 @@
+#ifndef __ARENA_H_
+#define __ARENA_H_
+
+#include <stddef.h>
+
+/**
+ * 一条命令的内存池，解析树的结点、参数字符串和作业的数据都从中分配，
+ * 命令结束时一次性释放。大多数情况下只有一个块
+ */
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+struct arena {
+    struct arena_chunk *head;   // 当前分配的块，较早的块通过 next 链接
+};
+
+struct arena *arena_new(size_t hint);
+void *arena_alloc(struct arena *a, size_t n);
+char *arena_strdup(struct arena *a, const char *s);
+char *arena_strndup(struct arena *a, const char *s, size_t n);
+void arena_reset(struct arena *a);
+void arena_free(struct arena *a);
+
+#endif
@@ -0,0 +1,635 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arith.h"
+#include "expand.h"
+#include "var.h"
+
+/*
+ * $(( )) 的算术表达式先编译为栈式的字节码再运行。编译的结果按表达式的文本缓存，
+ * 循环中同一个表达式每次展开时只需要查找缓存和运行字节码，不再解析。
+ * 表达式中的 $name 和 name 一样编译为对变量的引用，变量的值在运行时读取，
+ * 因此 $((i + 1)) 和 $(($i + 1)) 的文本都不随变量的值变化
+ */
+
+#define CACHE_SIZE 256      // 缓存的槽数，必须为 2 的幂，用掉一半时清空
+#define SMALL_STACK 64
+
+enum op {
+    OP_NUM,     // 压入常数 val
+    OP_VAR,     // 压入变量 names[val] 的值
+    OP_STORE,   // 将栈顶的值赋给变量 names[val]，值仍然留在栈上
+    OP_POP,
+    OP_JZ,      // 弹出栈顶，为零时跳转到 val
+    OP_JNZ,     // 弹出栈顶，非零时跳转到 val
+    OP_JMP,
+    OP_BOOL,    // 将栈顶变为 0 或 1
+    OP_NEG, OP_NOT, OP_BNOT,
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD, OP_POW, OP_SHL, OP_SHR,
+    OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE, OP_BAND, OP_BXOR, OP_BOR,
+    OP_AND, OP_OR,  // 只在编译时表示 && 和 ||，生成的是跳转
+};
+
+struct insn {
+    enum op op;
+    long val;
+};
+
+/**
+ * 编译好的表达式，运行时栈的深度不会超过指令数 n
+ */
+struct arith {
+    struct insn *code;
+    int n;
+    int cap;
+    char **names;       // 引用的变量名，由 malloc 分配
+    int nnames;
+};
+
+#define T_END -1
+#define T_NUM -2
+#define T_NAME -3
+
+/*
+ * 运算符，较长的在前，按最长匹配
+ */
+static const char *const ops[] = {
+    "<<=", ">>=", "**", "<<", ">>", "<=", ">=", "==", "!=", "&&", "||", "++", "--",
+    "+=", "-=", "*=", "/=", "%=", "&=", "^=", "|=",
+    "+", "-", "*", "/", "%", "<", ">", "&", "^", "|", "!", "~", "?", ":", "(", ")", ",", "=",
+};
+
+/*
+ * 二元运算符的优先级，数字越大越优先，** 为右结合
+ */
+static const struct {
+    const char *op;
+    int prec;
+    enum op code;
+} binops[] = {
+    { "||", 1, OP_OR }, { "&&", 2, OP_AND }, { "|", 3, OP_BOR }, { "^", 4, OP_BXOR },
+    { "&", 5, OP_BAND }, { "==", 6, OP_EQ }, { "!=", 6, OP_NE }, { "<", 7, OP_LT },
+    { "<=", 7, OP_LE }, { ">", 7, OP_GT }, { ">=", 7, OP_GE }, { "<<", 8, OP_SHL },
+    { ">>", 8, OP_SHR }, { "+", 9, OP_ADD }, { "-", 9, OP_SUB }, { "*", 10, OP_MUL },
+    { "/", 10, OP_DIV }, { "%", 10, OP_MOD }, { "**", 11, OP_POW },
+};
+
+/*
+ * 复合赋值运算符对应的运算
+ */
+static const struct {
+    const char *op;
+    enum op code;
+} assignops[] = {
+    { "+=", OP_ADD }, { "-=", OP_SUB }, { "*=", OP_MUL }, { "/=", OP_DIV }, { "%=", OP_MOD },
+    { "<<=", OP_SHL }, { ">>=", OP_SHR }, { "&=", OP_BAND }, { "^=", OP_BXOR }, { "|=", OP_BOR },
+};
+
+/**
+ * 编译时的状态，tok 为当前的记号：T_END、T_NUM、T_NAME 或者运算符在 ops 中的下标
+ */
+struct compiler {
+    const char *p;      // 下一个记号的开始，表达式以 '\0' 结尾
+    struct arith *code;
+    const char *err;
+    int tok;
+    long num;
+    const char *name;
+    size_t namelen;
+};
+
+/**
+ * 缓存的一项，text 为 NULL 表示空位
+ */
+struct entry {
+    char *text;
+    unsigned int hash;
+    struct arith *code;
+};
+
+static struct entry cache[CACHE_SIZE];
+static int ncached = 0;
+
+static void parse_expr(struct compiler *c);
+static void parse_assign(struct compiler *c);
+
+/**
+ * hash_text - len 字节的 FNV-1a 哈希
+ */
+static unsigned int hash_text(const char *s, size_t len) {
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+    }
+    return h;
+}
+
+/**
+ * next - 读取下一个记号，$name、${name} 和特殊参数 $1 $# $? $$ 都作为变量名
+ */
+static void next(struct compiler *c) {
+    const char *p = c->p;
+    char *end;
+
+    while (isspace((unsigned char)*p)) {
+        p++;
+    }
+    if (*p == '\0') {
+        c->tok = T_END;
+        c->p = p;
+        return;
+    }
+    if (isdigit((unsigned char)*p)) {
+        c->tok = T_NUM;
+        c->num = strtol(p, &end, 0);
+        if (isalnum((unsigned char)*end) || *end == '_') {
+            c->err = "无效的数字";
+        }
+        c->p = end;
+        return;
+    }
+    if (*p == '$' && p[1] == '{') {
+        const char *close = strchr(p, '}');
+        if (close == NULL || close == p + 2) {
+            c->err = "错误的替换";
+            return;
+        }
+        c->tok = T_NAME;
+        c->name = p + 2;
+        c->namelen = close - p - 2;
+        c->p = close + 1;
+        return;
+    }
+    if (*p == '$' && p[1] != '\0' && strchr("?$#0123456789", p[1]) != NULL) {
+        c->tok = T_NAME;
+        c->name = p + 1;
+        c->namelen = 1;
+        c->p = p + 2;
+        return;
+    }
+    if (*p == '$') {
+        p++;
+    }
+    if (var_isname(p, 1)) {
+        c->tok = T_NAME;
+        c->name = p;
+        for (c->namelen = 1; var_isname(p, c->namelen + 1); c->namelen++) {
+        }
+        c->p = p + c->namelen;
+        return;
+    }
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        size_t len = strlen(ops[i]);
+        if (strncmp(p, ops[i], len) == 0) {
+            c->tok = i;
+            c->p = p + len;
+            return;
+        }
+    }
+    c->err = "语法错误";
+}
+
+/**
+ * is - 判断当前记号是否为运算符 op
+ */
+static int is(struct compiler *c, const char *op) {
+    return c->tok >= 0 && strcmp(ops[c->tok], op) == 0;
+}
+
+/**
+ * emit - 加入一条指令，返回它的位置，用于之后填写跳转的目标
+ */
+static int emit(struct compiler *c, enum op op, long val) {
+    struct arith *code = c->code;
+    if (code->n == code->cap) {
+        code->cap = code->cap ? code->cap * 2 : 16;
+        code->code = (struct insn *)realloc(code->code, code->cap * sizeof(struct insn));
+    }
+    code->code[code->n].op = op;
+    code->code[code->n].val = val;
+    return code->n++;
+}
+
+/**
+ * name_index - 返回当前记号的变量名在 names 中的下标，不存在时加入
+ */
+static long name_index(struct compiler *c) {
+    struct arith *code = c->code;
+    for (int i = 0; i < code->nnames; i++) {
+        if (strlen(code->names[i]) == c->namelen && memcmp(code->names[i], c->name, c->namelen) == 0) {
+            return i;
+        }
+    }
+    code->names = (char **)realloc(code->names, (code->nnames + 1) * sizeof(char *));
+    code->names[code->nnames] = strndup(c->name, c->namelen);
+    return code->nnames++;
+}
+
+/**
+ * lvalue - 当前记号为可以赋值的变量名时返回它的下标，否则设置错误信息并返回 -1
+ */
+static long lvalue(struct compiler *c) {
+    if (c->tok != T_NAME || !var_isname(c->name, c->namelen)) {
+        c->err = "赋值的对象不是变量";
+        return -1;
+    }
+    return name_index(c);
+}
+
+/**
+ * parse_postfix - 常数、变量、x++、x-- 和括号中的表达式
+ */
+static void parse_postfix(struct compiler *c) {
+    if (c->tok == T_NUM) {
+        emit(c, OP_NUM, c->num);
+        next(c);
+    } else if (c->tok == T_NAME) {
+        struct compiler name = *c;
+        next(c);
+        if (is(c, "++") || is(c, "--")) {   // 值为原来的值
+            long var = lvalue(&name);
+            if (var < 0) {
+                c->err = name.err;
+                return;
+            }
+            emit(c, OP_VAR, var);
+            emit(c, OP_VAR, var);
+            emit(c, OP_NUM, 1);
+            emit(c, is(c, "++") ? OP_ADD : OP_SUB, 0);
+            emit(c, OP_STORE, var);
+            emit(c, OP_POP, 0);
+            next(c);
+        } else {
+            emit(c, OP_VAR, name_index(&name));
+        }
+    } else if (is(c, "(")) {
+        next(c);
+        parse_expr(c);
+        if (c->err == NULL && !is(c, ")")) {
+            c->err = "缺少 )";
+        }
+        next(c);
+    } else if (c->err == NULL) {
+        c->err = c->tok == T_END ? "缺少操作数" : "语法错误";
+    }
+}
+
+/**
+ * parse_unary - 一元运算符 - + ! ~ 以及 ++x、--x
+ */
+static void parse_unary(struct compiler *c) {
+    static const struct {
+        const char *op;
+        enum op code;
+    } unops[] = { { "-", OP_NEG }, { "!", OP_NOT }, { "~", OP_BNOT } };
+
+    if (c->err != NULL) {
+        return;
+    }
+    if (is(c, "+")) {
+        next(c);
+        parse_unary(c);
+        return;
+    }
+    for (size_t i = 0; i < sizeof(unops) / sizeof(unops[0]); i++) {
+        if (is(c, unops[i].op)) {
+            next(c);
+            parse_unary(c);
+            emit(c, unops[i].code, 0);
+            return;
+        }
+    }
+    if (is(c, "++") || is(c, "--")) {
+        enum op op = is(c, "++") ? OP_ADD : OP_SUB;
+        next(c);
+        long var = lvalue(c);
+        if (var < 0) {
+            return;
+        }
+        emit(c, OP_VAR, var);
+        emit(c, OP_NUM, 1);
+        emit(c, op, 0);
+        emit(c, OP_STORE, var);
+        next(c);
+        return;
+    }
+    parse_postfix(c);
+}
+
+/**
+ * parse_binary - 按优先级解析优先级不低于 min 的二元运算。
+ * && 和 || 编译为跳转，右边的操作数只在需要时计算
+ */
+static void parse_binary(struct compiler *c, int min) {
+    parse_unary(c);
+    while (c->err == NULL) {
+        size_t i;
+        for (i = 0; i < sizeof(binops) / sizeof(binops[0]) && !is(c, binops[i].op); i++) {
+        }
+        if (i == sizeof(binops) / sizeof(binops[0]) || binops[i].prec < min) {
+            return;
+        }
+        enum op op = binops[i].code;
+        int prec = binops[i].prec;
+        next(c);
+        if (op == OP_AND || op == OP_OR) {
+            int skip = emit(c, op == OP_AND ? OP_JZ : OP_JNZ, 0);
+            parse_binary(c, prec + 1);
+            emit(c, OP_BOOL, 0);
+            int jmp = emit(c, OP_JMP, 0);
+            c->code->code[skip].val = emit(c, OP_NUM, op == OP_OR);
+            c->code->code[jmp].val = c->code->n;
+        } else {
+            parse_binary(c, op == OP_POW ? prec : prec + 1);
+            emit(c, op, 0);
+        }
+    }
+}
+
+/**
+ * parse_cond - 条件表达式 a ? b : c，右结合
+ */
+static void parse_cond(struct compiler *c) {
+    parse_binary(c, 1);
+    if (c->err != NULL || !is(c, "?")) {
+        return;
+    }
+    next(c);
+    int skip = emit(c, OP_JZ, 0);
+    parse_expr(c);
+    if (c->err == NULL && !is(c, ":")) {
+        c->err = "缺少 :";
+        return;
+    }
+    next(c);
+    int jmp = emit(c, OP_JMP, 0);
+    c->code->code[skip].val = c->code->n;
+    parse_assign(c);
+    c->code->code[jmp].val = c->code->n;
+}
+
+/**
+ * parse_assign - 赋值 x = e 和复合赋值 x op= e，右结合，值为赋给变量的值
+ */
+static void parse_assign(struct compiler *c) {
+    if (c->err == NULL && c->tok == T_NAME) {
+        struct compiler peek = *c;
+        next(&peek);
+        if (peek.err == NULL && peek.tok >= 0 && strcmp(ops[peek.tok], "==") != 0 &&
+            ops[peek.tok][strlen(ops[peek.tok]) - 1] == '=' && strcmp(ops[peek.tok], "<=") != 0 &&
+            strcmp(ops[peek.tok], ">=") != 0 && strcmp(ops[peek.tok], "!=") != 0) {
+            long var = lvalue(c);
+            if (var < 0) {
+                return;
+            }
+            *c = peek;
+            enum op op = OP_NUM;
+            for (size_t i = 0; i < sizeof(assignops) / sizeof(assignops[0]); i++) {
+                if (is(c, assignops[i].op)) {
+                    op = assignops[i].code;
+                    emit(c, OP_VAR, var);
+                }
+            }
+            next(c);
+            parse_assign(c);
+            if (op != OP_NUM) {
+                emit(c, op, 0);
+            }
+            emit(c, OP_STORE, var);
+            return;
+        }
+    }
+    parse_cond(c);
+}
+
+/**
+ * parse_expr - 逗号分隔的表达式，值为最后一个
+ */
+static void parse_expr(struct compiler *c) {
+    parse_assign(c);
+    while (c->err == NULL && is(c, ",")) {
+        emit(c, OP_POP, 0);
+        next(c);
+        parse_assign(c);
+    }
+}
+
+static void arith_free(struct arith *code) {
+    for (int i = 0; i < code->nnames; i++) {
+        free(code->names[i]);
+    }
+    free(code->names);
+    free(code->code);
+    free(code);
+}
+
+/**
+ * compile - 编译以 '\0' 结尾的表达式 text，失败时返回 NULL 并通过 err 返回错误信息
+ */
+static struct arith *compile(const char *text, const char **err) {
+    struct arith *code = (struct arith *)calloc(1, sizeof(struct arith));
+    struct compiler c = { text, code, NULL };
+
+    next(&c);
+    if (c.tok == T_END && c.err == NULL) {  // 空的表达式，值为 0
+        emit(&c, OP_NUM, 0);
+    } else {
+        parse_expr(&c);
+    }
+    if (c.err == NULL && c.tok != T_END) {
+        c.err = "语法错误";
+    }
+    if (c.err != NULL) {
+        *err = c.err;
+        arith_free(code);
+        return NULL;
+    }
+    return code;
+}
+
+/**
+ * lookup_code - 在缓存中查找表达式 expr[0, len) 的字节码，不存在时编译并加入缓存
+ */
+static struct arith *lookup_code(const char *expr, size_t len, const char **err) {
+    unsigned int h = hash_text(expr, len);
+    unsigned int i;
+
+    for (i = h & (CACHE_SIZE - 1); cache[i].text != NULL; i = (i + 1) & (CACHE_SIZE - 1)) {
+        if (cache[i].hash == h && strncmp(cache[i].text, expr, len) == 0 && cache[i].text[len] == '\0') {
+            return cache[i].code;
+        }
+    }
+    char *text = strndup(expr, len);
+    struct arith *code = compile(text, err);
+    if (code == NULL) {
+        free(text);
+        return NULL;
+    }
+    if (ncached * 2 >= CACHE_SIZE) {  // 缓存满了，全部清空，重新开始
+        for (int j = 0; j < CACHE_SIZE; j++) {
+            if (cache[j].text != NULL) {
+                free(cache[j].text);
+                arith_free(cache[j].code);
+                cache[j].text = NULL;
+            }
+        }
+        ncached = 0;
+        i = h & (CACHE_SIZE - 1);
+    }
+    cache[i].text = text;
+    cache[i].hash = h;
+    cache[i].code = code;
+    ncached++;
+    return code;
+}
+
+/**
+ * var_value - 读取变量 name 的整数值，未设置或为空时为 0，不是整数时返回 -1
+ */
+static int var_value(const char *name, long *value) {
+    char num[32], *end;
+    const char *s = param_value(name, num, sizeof(num));
+    if (s == NULL || *s == '\0') {
+        *value = 0;
+        return 0;
+    }
+    *value = strtol(s, &end, 0);
+    while (isspace((unsigned char)*end)) {
+        end++;
+    }
+    if (*end != '\0' || end == s) {
+        fprintf(stderr, "myshell: %s: 需要整数表达式\n", s);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * binop - 计算二元运算 a op b，加减乘按无符号数计算，溢出时回绕而不是未定义
+ */
+static int binop(enum op op, long a, long b, long *r) {
+    unsigned long x = a, y = b;
+    switch (op) {
+        case OP_ADD: *r = (long)(x + y); break;
+        case OP_SUB: *r = (long)(x - y); break;
+        case OP_MUL: *r = (long)(x * y); break;
+        case OP_DIV:
+        case OP_MOD:
+            if (b == 0) {
+                fprintf(stderr, "myshell: 除数为 0\n");
+                return -1;
+            }
+            if (b == -1) {  // 避免 LONG_MIN / -1 溢出
+                *r = op == OP_DIV ? (long)(0 - x) : 0;
+            } else {
+                *r = op == OP_DIV ? a / b : a % b;
+            }
+            break;
+        case OP_POW:
+            if (b < 0) {
+                fprintf(stderr, "myshell: 指数小于 0\n");
+                return -1;
+            }
+            for (unsigned long p = 1; ; x *= x) {
+                if (y & 1) {
+                    p *= x;
+                }
+                if ((y >>= 1) == 0) {
+                    *r = (long)p;
+                    break;
+                }
+            }
+            break;
+        case OP_SHL: *r = (long)(x << (b & 63)); break;
+        case OP_SHR: *r = a >> (b & 63); break;
+        case OP_LT: *r = a < b; break;
+        case OP_LE: *r = a <= b; break;
+        case OP_GT: *r = a > b; break;
+        case OP_GE: *r = a >= b; break;
+        case OP_EQ: *r = a == b; break;
+        case OP_NE: *r = a != b; break;
+        case OP_BAND: *r = a & b; break;
+        case OP_BXOR: *r = a ^ b; break;
+        case OP_BOR: *r = a | b; break;
+        default: *r = 0;
+    }
+    return 0;
+}
+
+/**
+ * run - 运行字节码，结果通过 result 返回，出错时返回 -1
+ */
+static int run(const struct arith *code, long *result) {
+    long small[SMALL_STACK];
+    long *st = code->n <= SMALL_STACK ? small : (long *)malloc(code->n * sizeof(long));
+    char num[32];
+    int sp = 0, ret = 0;
+
+    for (int pc = 0; pc < code->n && ret == 0; pc++) {
+        const struct insn *in = &code->code[pc];
+        switch (in->op) {
+            case OP_NUM:
+                st[sp++] = in->val;
+                break;
+            case OP_VAR:
+                ret = var_value(code->names[in->val], &st[sp++]);
+                break;
+            case OP_STORE:
+                snprintf(num, sizeof(num), "%ld", st[sp - 1]);
+                var_set(code->names[in->val], num);
+                break;
+            case OP_POP:
+                sp--;
+                break;
+            case OP_JZ:
+                if (st[--sp] == 0) {
+                    pc = in->val - 1;
+                }
+                break;
+            case OP_JNZ:
+                if (st[--sp] != 0) {
+                    pc = in->val - 1;
+                }
+                break;
+            case OP_JMP:
+                pc = in->val - 1;
+                break;
+            case OP_BOOL:
+                st[sp - 1] = st[sp - 1] != 0;
+                break;
+            case OP_NEG:
+                st[sp - 1] = (long)(0 - (unsigned long)st[sp - 1]);
+                break;
+            case OP_NOT:
+                st[sp - 1] = !st[sp - 1];
+                break;
+            case OP_BNOT:
+                st[sp - 1] = ~st[sp - 1];
+                break;
+            default:
+                sp--;
+                ret = binop(in->op, st[sp - 1], st[sp], &st[sp - 1]);
+        }
+    }
+    *result = st[0];
+    if (st != small) {
+        free(st);
+    }
+    return ret;
+}
+
+/**
+ * arith_eval - 计算算术表达式 expr[0, len)，编译的字节码按表达式的文本缓存，
+ * 同一个表达式再次计算时不再解析。出错时输出错误信息并返回 -1
+ */
+int arith_eval(const char *expr, size_t len, long *result) {
+    const char *err = NULL;
+    struct arith *code = lookup_code(expr, len, &err);
+    if (code == NULL) {
+        fprintf(stderr, "myshell: %.*s: %s\n", (int)len, expr, err);
+        return -1;
+    }
+    return run(code, result);
+}
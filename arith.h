@@ -0,0 +1,8 @@
+#ifndef __ARITH_H_
+#define __ARITH_H_
+
+#include <stddef.h>
+
+int arith_eval(const char *expr, size_t len, long *result);
+
+#endif
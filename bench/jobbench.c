@@ -0,0 +1,73 @@
+/*
+ * jobbench.c - 作业表的压力测试：同时保持大量后台作业
+ *
+ * usage: jobbench <shell> [n] [secs]
+ * 生成一个脚本，启动 n 个（默认 10000 个）运行 secs 秒（默认 60 秒）的后台作业，
+ * 然后运行 jobs。secs 需要长于启动所有作业的时间，检查 jobs 列出的作业数是否为 n，
+ * 输出 CSV：
+ * jobs,seconds,jobs_per_sec,listed
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    char script[] = "/tmp/jobbenchXXXXXX";
+    char line[4096];
+    int n = 10000, secs = 60, listed = 0, fds[2];
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <shell> [n] [secs]\n", argv[0]);
+        exit(1);
+    }
+    if (argc > 2) {
+        n = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        secs = atoi(argv[3]);
+    }
+    int fd = mkstemp(script);
+    FILE *fp = fdopen(fd, "w");
+    for (int i = 0; i < n; i++) {
+        // 后台作业的输出不能留在管道中，否则要等到它们结束才能读到文件末尾
+        fprintf(fp, "/bin/sleep %d > /dev/null &\n", secs);
+    }
+    fputs("jobs\n", fp);
+    fclose(fp);
+
+    double start = now();
+    pipe(fds);
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fds[1], 1);
+        close(fds[0]);
+        close(fds[1]);
+        execl(argv[1], argv[1], script, (char *)NULL);
+        perror(argv[1]);
+        _exit(127);
+    }
+    close(fds[1]);
+    fp = fdopen(fds[0], "r");
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (strstr(line, " Running ") != NULL) {
+            listed++;
+        }
+    }
+    fclose(fp);
+    waitpid(pid, NULL, 0);
+    double elapsed = now() - start;
+
+    printf("jobs,seconds,jobs_per_sec,listed\n");
+    printf("%d,%.3f,%.0f,%d\n", n, elapsed, n / elapsed, listed);
+    unlink(script);
+    exit(listed == n ? 0 : 1);
+}
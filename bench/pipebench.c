@@ -0,0 +1,104 @@
+/*
+ * pipebench.c - 测量 myshell 的管道在各段之间搬运数据的吞吐量
+ *
+ * usage: pipebench <shell> [mb]
+ * 生成一个 mb MB（默认 256 MB）的输入文件，以脚本模式运行下面的管道，
+ * 输出写到另一个文件，检查输出与输入的大小相同，输出 CSV：
+ * scenario,mb,seconds,mb_per_sec,ok
+ *   cat            cat in | cat > out，原来的方式，64 KiB 的管道
+ *   cat_pipesize   同上，set -o pipesize 将管道设为系统允许的最大容量
+ *   scat           scat in | scat > out，文件到管道、管道到文件都使用 splice
+ *   scat_pipesize  同上，加上 set -o pipesize
+ *   stee_pipesize  scat in | stee out，stee 用 tee 复制到标准输出（/dev/null），splice 写入文件
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* 运行 shell script，标准输出为 /dev/null，返回耗时（秒） */
+static double run(const char *shell, const char *script) {
+    double start = now();
+    pid_t pid = fork();
+    if (pid == 0) {
+        int fd = open("/dev/null", O_WRONLY);
+        dup2(fd, 1);
+        close(fd);
+        execl(shell, shell, script, (char *)NULL);
+        perror(shell);
+        _exit(127);
+    }
+    waitpid(pid, NULL, 0);
+    return now() - start;
+}
+
+/* 生成 size 字节的输入文件，内容不是全零，避免文件系统的特殊处理 */
+static void make_input(const char *path, long size) {
+    static char buf[1 << 16];
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        buf[i] = (char)(i * 2654435761u >> 13);
+    }
+    int fd = open(path, O_WRONLY | O_TRUNC);
+    for (long off = 0; off < size; off += sizeof(buf)) {
+        if (write(fd, buf, sizeof(buf)) < 0) {
+            perror(path);
+            exit(1);
+        }
+    }
+    close(fd);
+}
+
+int main(int argc, char **argv) {
+    static const struct {
+        const char *name;
+        const char *fmt;    // 管道，两个 %s 依次为输入和输出文件
+    } scenarios[] = {
+        { "cat", "cat %s | cat > %s\n" },
+        { "cat_pipesize", "set -o pipesize\ncat %s | cat > %s\n" },
+        { "scat", "scat %s | scat > %s\n" },
+        { "scat_pipesize", "set -o pipesize\nscat %s | scat > %s\n" },
+        { "stee_pipesize", "set -o pipesize\nscat %s | stee %s\n" },
+    };
+    char script[] = "/tmp/pipebenchXXXXXX";
+    char in[] = "/tmp/pipeinXXXXXX";
+    char out[] = "/tmp/pipeoutXXXXXX";
+    struct stat st;
+    int mb = 256;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <shell> [mb]\n", argv[0]);
+        exit(1);
+    }
+    if (argc > 2) {
+        mb = atoi(argv[2]);
+    }
+    close(mkstemp(script));
+    close(mkstemp(in));
+    close(mkstemp(out));
+    make_input(in, (long)mb << 20);
+
+    printf("scenario,mb,seconds,mb_per_sec,ok\n");
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        FILE *fp = fopen(script, "w");
+        fprintf(fp, scenarios[i].fmt, in, out);
+        fclose(fp);
+        truncate(out, 0);
+        double secs = run(argv[1], script);
+        int ok = stat(out, &st) == 0 && st.st_size == (off_t)mb << 20;
+        printf("%s,%d,%.3f,%.0f,%d\n", scenarios[i].name, mb, secs, mb / secs, ok);
+    }
+    unlink(script);
+    unlink(in);
+    unlink(out);
+    exit(0);
+}
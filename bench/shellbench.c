@@ -0,0 +1,223 @@
+/*
+ * shellbench.c - myshell 的基准测试，用合成的脚本测量 shell 自身的开销
+ *
+ * usage: shellbench <shell> [-n n] [-c file.csv] [-j file.json]
+ * 每个场景生成一个脚本，以脚本模式运行 shell，测量总耗时，并通过
+ * MYSHELL_STATS 取得 shell 内部的 wait/wakeup/reap 阶段的 p50 和 p99。场景为：
+ *   external   n 条顺序执行的外部命令 /bin/true
+ *   builtin    n 条只有内部命令的命令
+ *   pipeline   n 条 k 段的管道，k = 1, 2, 4, 8
+ *   fanout     n 个后台作业
+ *   reap       保持 n 个后台作业的同时顺序执行 n 条外部命令
+ *   parse      n 行只解析、不执行的长命令（语法错误）
+ * 结果以 CSV 输出到标准输出（和 -c 指定的文件），以 JSON 写入 -j 指定的文件
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+struct result {
+    const char *scenario;
+    int param;          // 管道的段数等参数，没有时为 0
+    int n;              // 操作的次数
+    double seconds;
+    double rate;        // 每秒的操作次数
+    const char *unit;
+    double wait_p50;    // shell 内部统计的 wait 阶段（微秒），没有时为 -1
+    double wait_p99;
+    double wakeup_p50;  // 回收前台作业的最后一个进程到 waitfg 结束等待（微秒），没有时为 -1
+    double wakeup_p99;
+    double reap_p50;    // shell 内部统计的 reap 阶段（微秒），没有时为 -1
+    double reap_p99;
+};
+
+static struct result results[32];
+static int nresults = 0;
+static char script[] = "/tmp/shellbenchXXXXXX";
+static char stats[] = "/tmp/shellstatsXXXXXX";
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* 打开脚本文件，从头开始写 */
+static FILE *begin_script(void) {
+    FILE *fp = fopen(script, "w");
+    if (fp == NULL) {
+        perror(script);
+        exit(1);
+    }
+    return fp;
+}
+
+/* 从 shell 退出时输出的统计中读出 phase 阶段的 p50 和 p99 */
+static void read_phase(const char *phase, double *p50, double *p99) {
+    char line[256], name[32];
+    double count, mean, p90, max;
+    FILE *fp = fopen(stats, "r");
+    *p50 = *p99 = -1;
+    if (fp == NULL) {
+        return;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "%31s %lf %lf %lf %lf %lf %lf", name, &count, &mean, p50, &p90, p99, &max) == 7 &&
+            strcmp(name, phase) == 0) {
+            break;
+        }
+        *p50 = *p99 = -1;
+    }
+    fclose(fp);
+}
+
+/* 运行 shell 执行脚本，输出丢弃，记录一条结果 */
+static void run(const char *shell, const char *scenario, int param, int n, const char *unit) {
+    struct result *r = &results[nresults++];
+    truncate(stats, 0);
+    double start = now();
+    pid_t pid = fork();
+    if (pid == 0) {
+        int fd = open("/dev/null", O_WRONLY);
+        dup2(fd, 1);
+        dup2(fd, 2);
+        close(fd);
+        setenv("MYSHELL_STATS", stats, 1);
+        execl(shell, shell, script, (char *)NULL);
+        _exit(127);
+    }
+    waitpid(pid, NULL, 0);
+    r->seconds = now() - start;
+    r->scenario = scenario;
+    r->param = param;
+    r->n = n;
+    r->rate = n / r->seconds;
+    r->unit = unit;
+    read_phase("wait", &r->wait_p50, &r->wait_p99);
+    read_phase("wakeup", &r->wakeup_p50, &r->wakeup_p99);
+    read_phase("reap", &r->reap_p50, &r->reap_p99);
+}
+
+static void write_csv(FILE *fp) {
+    fprintf(fp, "scenario,param,n,seconds,rate,unit,wait_p50_us,wait_p99_us,"
+            "wakeup_p50_us,wakeup_p99_us,reap_p50_us,reap_p99_us\n");
+    for (int i = 0; i < nresults; i++) {
+        struct result *r = &results[i];
+        fprintf(fp, "%s,%d,%d,%.4f,%.1f,%s,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n", r->scenario, r->param, r->n,
+                r->seconds, r->rate, r->unit, r->wait_p50, r->wait_p99, r->wakeup_p50, r->wakeup_p99,
+                r->reap_p50, r->reap_p99);
+    }
+}
+
+static void write_json(FILE *fp) {
+    fprintf(fp, "[\n");
+    for (int i = 0; i < nresults; i++) {
+        struct result *r = &results[i];
+        fprintf(fp, "  {\"scenario\": \"%s\", \"param\": %d, \"n\": %d, \"seconds\": %.4f, "
+                "\"rate\": %.1f, \"unit\": \"%s\", \"wait_p50_us\": %.1f, \"wait_p99_us\": %.1f, "
+                "\"wakeup_p50_us\": %.1f, \"wakeup_p99_us\": %.1f, "
+                "\"reap_p50_us\": %.1f, \"reap_p99_us\": %.1f}%s\n",
+                r->scenario, r->param, r->n, r->seconds, r->rate, r->unit, r->wait_p50, r->wait_p99,
+                r->wakeup_p50, r->wakeup_p99, r->reap_p50, r->reap_p99, i < nresults - 1 ? "," : "");
+    }
+    fprintf(fp, "]\n");
+}
+
+int main(int argc, char **argv) {
+    const char *csv = NULL, *json = NULL;
+    int n = 1000, opt;
+    FILE *fp;
+
+    while ((opt = getopt(argc, argv, "n:c:j:")) != -1) {
+        switch (opt) {
+            case 'n':
+                n = atoi(optarg);
+                break;
+            case 'c':
+                csv = optarg;
+                break;
+            case 'j':
+                json = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s <shell> [-n n] [-c file.csv] [-j file.json]\n", argv[0]);
+                exit(1);
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s <shell> [-n n] [-c file.csv] [-j file.json]\n", argv[0]);
+        exit(1);
+    }
+    const char *shell = argv[optind];
+    close(mkstemp(script));
+    close(mkstemp(stats));
+
+    fp = begin_script();
+    for (int i = 0; i < n; i++) {
+        fputs("/bin/true\n", fp);
+    }
+    fclose(fp);
+    run(shell, "external", 0, n, "cmds/s");
+
+    fp = begin_script();
+    for (int i = 0; i < n; i++) {
+        fputs("pwd\n", fp);
+    }
+    fclose(fp);
+    run(shell, "builtin", 0, n, "cmds/s");
+
+    for (int k = 1; k <= 8; k *= 2) {
+        fp = begin_script();
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < k; j++) {
+                fputs(j ? " | /bin/true" : "/bin/true", fp);
+            }
+            fputc('\n', fp);
+        }
+        fclose(fp);
+        run(shell, "pipeline", k, n, "pipelines/s");
+    }
+
+    fp = begin_script();
+    for (int i = 0; i < n; i++) {
+        fputs("/bin/true &\n", fp);
+    }
+    fclose(fp);
+    run(shell, "fanout", 0, n, "jobs/s");
+
+    // 每一行都有引号、重定向和多个参数，最后的 | 使其成为语法错误，只解析不执行
+    fp = begin_script();
+    for (int i = 0; i < n; i++) {
+        fputs("cmd -a -b --long=value \"quoted arg\" 'single quoted' a\\ b < in > out x y z |\n", fp);
+    }
+    fclose(fp);
+    run(shell, "parse", 0, n, "lines/s");
+
+    // 后台作业运行 5 秒，在它们结束之前完成前台的命令
+    fp = begin_script();
+    for (int i = 0; i < n; i++) {
+        fputs("/bin/sleep 5 > /dev/null &\n", fp);
+    }
+    for (int i = 0; i < n; i++) {
+        fputs("/bin/true\n", fp);
+    }
+    fclose(fp);
+    run(shell, "reap", n, 2 * n, "cmds/s");
+
+    write_csv(stdout);
+    if (csv != NULL && (fp = fopen(csv, "w")) != NULL) {
+        write_csv(fp);
+        fclose(fp);
+    }
+    if (json != NULL && (fp = fopen(json, "w")) != NULL) {
+        write_json(fp);
+        fclose(fp);
+    }
+    unlink(script);
+    unlink(stats);
+    exit(0);
+}
@@ -0,0 +1,67 @@
+/*
+ * spawnbench.c - 测量 myshell 每秒能运行多少条外部命令
+ *
+ * usage: spawnbench <shell> [n]
+ * 生成一个包含 n 行 /bin/true 的脚本（默认 2000 行），分别以
+ * MYSHELL_SPAWN=fork/vfork/posix_spawn 运行 shell，输出 CSV：
+ * mode,commands,seconds,cmds_per_sec
+ * fork 方式即为原来每条命令 fork 一次 shell 的开销
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* 以 MYSHELL_SPAWN=mode 运行 shell script，返回耗时（秒） */
+static double run(const char *shell, const char *script, const char *mode) {
+    double start = now();
+    pid_t pid = fork();
+    if (pid == 0) {
+        int fd = open("/dev/null", O_WRONLY);
+        dup2(fd, 1);
+        close(fd);
+        setenv("MYSHELL_SPAWN", mode, 1);
+        execl(shell, shell, script, (char *)NULL);
+        perror(shell);
+        _exit(127);
+    }
+    waitpid(pid, NULL, 0);
+    return now() - start;
+}
+
+int main(int argc, char **argv) {
+    static const char *modes[] = { "fork", "vfork", "posix_spawn" };
+    char script[] = "/tmp/spawnbenchXXXXXX";
+    int n = 2000;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <shell> [n]\n", argv[0]);
+        exit(1);
+    }
+    if (argc > 2) {
+        n = atoi(argv[2]);
+    }
+    int fd = mkstemp(script);
+    FILE *fp = fdopen(fd, "w");
+    for (int i = 0; i < n; i++) {
+        fputs("/bin/true\n", fp);
+    }
+    fclose(fp);
+
+    printf("mode,commands,seconds,cmds_per_sec\n");
+    for (int i = 0; i < 3; i++) {
+        double secs = run(argv[1], script, modes[i]);
+        printf("%s,%d,%.3f,%.0f\n", modes[i], n, secs, n / secs);
+    }
+    unlink(script);
+    exit(0);
+}
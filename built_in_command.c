@@ -1,4 +1,5 @@
 #include <dirent.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
@@ -9,48 +10,134 @@
 #include <unistd.h>
 
 #include "built_in_command.h"
+#include "cmdhash.h"
+#include "pipeio.h"
+#include "stats.h"
+#include "var.h"
 #define MAXLEN 512
 extern char pwd[MAXLEN];
 extern mode_t mode;
+extern int pipefail;
+extern int maxjobs;
+extern int pipesize;
+extern int last_status;
+extern int *last_pipestatus;
+extern int last_npipe;
+
+/* 编译时确定的内部命令表，顺序与 builtins.def 相同 */
+#define BUILTIN(name, fn, flags) { #name, fn, flags },
+static const struct builtin builtin_table[] = {
+#include "builtins.def"
+};
+#undef BUILTIN
+
+#include "builtin_hash.h"
+
+static struct builtin *registered = NULL;  // 运行时通过 builtin_register 注册的内部命令
+static int nregistered = 0;
+
+/**
+ * builtin_lookup - 查找名为 name 的内部命令，只查找，不运行，不是内部命令时返回 NULL。
+ * 编译时生成的内部命令通过完美哈希查找，只需要一次哈希和一次 strcmp
+ */
+const struct builtin *builtin_lookup(const char *name) {
+    int i = builtin_slots[builtin_hash(name, BUILTIN_SEED) & (BUILTIN_SLOTS - 1)];
+    if (i >= 0 && strcmp(builtin_table[i].name, name) == 0) {
+        return &builtin_table[i];
+    }
+    for (i = 0; i < nregistered; i++) {
+        if (strcmp(registered[i].name, name) == 0) {
+            return &registered[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * builtin_register - 在运行时注册一个内部命令，名字已经存在时返回 -1
+ */
+int builtin_register(const char *name, builtin_fn *fn, int flags) {
+    if (builtin_lookup(name) != NULL) {
+        return -1;
+    }
+    registered = (struct builtin *)realloc(registered, (nregistered + 1) * sizeof(struct builtin));
+    registered[nregistered].name = strdup(name);
+    registered[nregistered].fn = fn;
+    registered[nregistered].flags = flags;
+    nregistered++;
+    return 0;
+}
 
 /**
  * cd_imp - cd 命令的实现，更改环境变量 PWD
  */
-void cd_imp(const char *dir_path) {
+int cd_imp(int argc, char *argv[]) {
+    char *dir_path = argv[1];
     if (dir_path == NULL || strcmp(dir_path, ".") == 0) {
         // 如果 cd 当前目录或给定目录为空，则输出当前目录
         printf("%s\n", pwd);
-        return;
+        return 0;
     }
     // 首先判断是否为目录
     struct stat buf;
-    stat(dir_path, &buf);
-    if (!S_ISDIR(buf.st_mode)) {
+    if (stat(dir_path, &buf) < 0 || !S_ISDIR(buf.st_mode)) {
         fprintf(stderr, "cd: %s: 没有那个文件或目录\n", dir_path);
-        return;
+        return 1;
     }
 
     // 更改当前工作目录，然后修改 pwd 变量
     if (chdir(dir_path) != 0) {
         fprintf(stderr, "cd 发生错误\n");
-        return;
+        return 1;
     }
     getcwd(pwd, MAXLEN);
-    // 更改环境变量
-    setenv("PWD", pwd, 1);
+    // 更改环境变量，子进程下一次创建时才重新构造环境
+    var_set("PWD", pwd);
+    return 0;
+}
+
+/**
+ * stats_imp - 输出 shell 主循环各个阶段的耗时分布，然后清空
+ */
+int stats_imp(int argc, char *argv[]) {
+#ifdef NO_STATS
+    fprintf(stderr, "stats: 编译时没有启用统计（-DNO_STATS）\n");
+    return 1;
+#else
+    stats_print(stdout);
+    stats_reset();
+    return 0;
+#endif
+}
+
+/**
+ * pwd_imp - 输出当前工作目录
+ */
+int pwd_imp(int argc, char *argv[]) {
+    printf("%s\n", pwd);
+    return 0;
+}
+
+/**
+ * exit_imp - 退出 shell，退出状态为参数，没有参数时为上一个命令的状态
+ */
+int exit_imp(int argc, char *argv[]) {
+    exit(argc > 1 ? atoi(argv[1]) : last_status);
 }
 
 /**
  * dir_imp - 列出目录 dir_path 中的内容，若 dir_path 为空，
  * 则列出当前工作目录下的内容
  */
-void dir_imp(char *dir_path) {
+int dir_imp(int argc, char *argv[]) {
+    char *dir_path = argv[1];
     DIR *dir;
     struct dirent *entry;
     if (dir_path) {
         dir = opendir(dir_path);
         if (dir == NULL) {
             fprintf(stderr, "%s 不为目录\n", dir_path);
+            return 1;
         }
     } else {
         dir = opendir(pwd);
@@ -64,161 +151,254 @@ void dir_imp(char *dir_path) {
     }
     printf("\n");
     closedir(dir);
+    return 0;
 }
 
 /**
- * echo_imp - 在屏幕上输出 argv 中传入的字符串
+ * echo_imp - 在屏幕上输出 argv 中传入的字符串，以空格分隔，最后一个之后没有空格，
+ * 这样 $(echo ...) 的结果不会多出空格
  */
-void echo_imp(char *argv[]) {
-    char *str = argv[1];
-    for (int i = 1; str != NULL; i++, str = argv[i]) {
-        printf("%s ", str);
+int echo_imp(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        fputs(argv[i], stdout);
+        if (i < argc - 1) {
+            putchar(' ');
+        }
     }
-    printf("\n");
+    putchar('\n');
+    return 0;
 }
 
 /**
  * clr_imp - 刷新屏幕，持续输出换行符清空当前屏幕，
  * 然后将光标移动到最顶端
  */
-void clr_imp() {
+int clr_imp(int argc, char *argv[]) {
     // 获取终端大小
     struct winsize size;
     if (ioctl(STDIN_FILENO, TIOCGWINSZ, &size) == -1) {
         fprintf(stderr, "clr: 出现错误\n");
-        return;
+        return 1;
     }
     for (int i = 0; i < size.ws_row; i++) {
         printf("\n");
     }
     printf("\033[%dA", size.ws_row);
+    return 0;
 }
 
 /**
- * time_imp - 显示当前时间
+ * time_imp - 显示当前时间，time 后面带有命令时由 shell 在解析之后处理
  */
-void time_imp() {
+int time_imp(int argc, char *argv[]) {
     time_t current_time;
     struct tm *cur_time;
     time(&current_time);
     cur_time = localtime(&current_time);
     printf("%s", asctime(cur_time));
+    return 0;
 }
 
 /**
  * help_imp - 输出帮助手册
  */
-void help_imp() {
+int help_imp(int argc, char *argv[]) {
     printf("下面这些 shell 命令是内部定义的\n\n");
     printf("help 帮助手册\n");
+    printf("hash [-r] [命令 ...] 列出、添加或清空命令路径的缓存\n");
     printf("bg [任务声明 ...]\n");
     printf("fg [任务声明]\n");
+    printf("kill [-信号] <%%作业号 | 进程号 ...> 向作业或进程发送信号，默认为 TERM，排队的作业直接删除\n");
     printf("exit 退出 shell\n");
     printf("pwd 显示当前目录\n");
     printf("cd <目录> 更改当前目录\n");
-    printf("jobs 列出当前所有的任务\n");
+    printf("jobs [-l] 列出当前所有的任务，-l 同时显示资源使用情况\n");
+    printf("parallel [-j 数量] [-n 数量 | -m] [-k] 命令 [参数 ...] [::: 参数 ...] "
+           "同时运行多个命令，参数在 ::: 之后或者从标准输入读入\n");
     printf("umask 模式]\n");
-    printf("test [表达式]\n");
-    printf("time 显示当前时间\n");
+    printf("test [表达式] / [ 表达式 ] 求出条件表达式，通过退出状态返回结果\n");
+    printf("true / false 以状态 0 / 1 退出\n");
+    printf("if 命令; then 命令; [elif 命令; then 命令;] [else 命令;] fi\n");
+    printf("while 命令; do 命令; done\n");
+    printf("for 变量 [in 单词 ...]; do 命令; done\n");
+    printf("break [n] / continue [n] 退出循环 / 继续循环的下一次\n");
+    printf("$(命令) / `命令` 命令替换，替换为命令的输出，去掉末尾的换行符\n");
+    printf("time [管道] 显示当前时间，或者运行管道并显示每一段的资源使用情况\n");
     printf("echo <comment>\n");
     printf("dir [目录] 列出目录的内容\n");
-    printf("set 显示所有的环境变量\n");
+    printf("set [-o|+o 选项] 显示所有的变量，或者设置选项（pipefail、maxjobs=N、pipesize[=N]）\n");
+    printf("scat [文件 ...] / stee [-a] [文件 ...] 与 cat / tee 相同，用 splice 和 tee 在内核中移动数据\n");
+    printf("export [变量[=值] ...] 导出变量到子进程的环境中，没有参数时显示导出的变量\n");
+    printf("unset <变量 ...> 删除变量\n");
+    printf("status 显示上一个前台作业及其每一段的退出状态\n");
+    printf("stats 显示并清空 shell 各个阶段的耗时分布（p50/p90/p99）\n");
     printf("clr 清屏\n");
+    return 0;
+}
+
+/**
+ * set_imp - 没有参数时按名字的顺序输出所有的变量；
+ * set -o 选项 / set +o 选项 打开或关闭 shell 的选项，set -o 输出所有选项。
+ * set -o maxjobs=N 限制同时运行的后台作业数，超出的作业排队，set +o maxjobs 取消限制；
+ * set -o pipesize[=N] 将管道的容量设置为 N 字节，没有 N 时为系统允许的最大值
+ */
+int set_imp(int argc, char *argv[]) {
+    if (argc >= 2) {
+        if (strcmp(argv[1], "-o") != 0 && strcmp(argv[1], "+o") != 0) {
+            fprintf(stderr, "set: %s: 无效的选项\n", argv[1]);
+            return 1;
+        }
+        if (argc == 2) {
+            printf("pipefail\t%s\n", pipefail ? "on" : "off");
+            printf("maxjobs\t\t%d\n", maxjobs);
+            printf("pipesize\t%d\n", pipesize);
+        } else if (strcmp(argv[2], "pipefail") == 0) {
+            pipefail = argv[1][0] == '-';
+        } else if (strncmp(argv[2], "maxjobs", 7) == 0 && (argv[2][7] == '\0' || argv[2][7] == '=')) {
+            char *end = NULL;
+            long n = argv[1][0] == '-' && argv[2][7] == '=' ? strtol(argv[2] + 8, &end, 10) : 0;
+            if (argv[1][0] == '-' && (argv[2][7] != '=' || end == argv[2] + 8 || *end != '\0' ||
+                                      n <= 0 || n > INT_MAX)) {
+                fprintf(stderr, "set: maxjobs 需要正整数，如 set -o maxjobs=4\n");
+                return 1;
+            }
+            maxjobs = n;
+            promote_queued();   // 限制放宽之后立即启动排队的作业
+        } else if (strncmp(argv[2], "pipesize", 8) == 0 && (argv[2][8] == '\0' || argv[2][8] == '=')) {
+            char *end = NULL;
+            long max = pipe_max_size();
+            long n = argv[2][8] == '=' ? strtol(argv[2] + 9, &end, 10) : max;
+            if (argv[2][8] == '=' && (end == argv[2] + 9 || *end != '\0' || n <= 0)) {
+                fprintf(stderr, "set: pipesize 需要正整数（字节），如 set -o pipesize=1048576\n");
+                return 1;
+            }
+            // 超过上限时普通用户的 F_SETPIPE_SZ 会失败，因此截断到上限
+            pipesize = argv[1][0] == '-' ? (n < max ? n : max) : 0;
+        } else {
+            fprintf(stderr, "set: %s: 无效的选项名\n", argv[2]);
+            return 1;
+        }
+        return 0;
+    }
+    var_print(stdout, 0);
+    return 0;
 }
 
 /**
- * set_imp - 输出所有的环境变量
+ * export_imp - 导出参数中的每一个变量，参数为 name=value 时同时赋值；
+ * 没有参数时输出所有导出的变量
  */
-void set_imp(void) {
-    char *str = __environ[0];
-    for (int i = 0; str != NULL; i++, str = __environ[i]) {
-        printf("%s\n", str);
+int export_imp(int argc, char *argv[]) {
+    int ret = 0;
+    if (argc < 2) {
+        var_print(stdout, 1);
+        return 0;
+    }
+    for (int i = 1; i < argc; i++) {
+        char *eq = strchr(argv[i], '=');
+        if (!var_isname(argv[i], eq ? (size_t)(eq - argv[i]) : strlen(argv[i]))) {
+            fprintf(stderr, "export: %s: 不是有效的变量名\n", argv[i]);
+            ret = 1;
+        } else if (eq != NULL) {
+            var_assign(argv[i], 1);
+        } else {
+            var_export(argv[i], NULL);
+        }
     }
+    return ret;
+}
+
+/**
+ * unset_imp - 删除参数中的每一个变量
+ */
+int unset_imp(int argc, char *argv[]) {
+    int ret = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!var_isname(argv[i], strlen(argv[i]))) {
+            fprintf(stderr, "unset: %s: 不是有效的变量名\n", argv[i]);
+            ret = 1;
+            continue;
+        }
+        var_unset(argv[i]);
+    }
+    return ret;
+}
+
+/**
+ * true_imp - true 内部命令，什么也不做，状态为 0，用于条件和无限循环
+ */
+int true_imp(int argc, char *argv[]) {
+    return 0;
+}
+
+/**
+ * false_imp - false 内部命令，什么也不做，状态为 1
+ */
+int false_imp(int argc, char *argv[]) {
+    return 1;
+}
+
+/**
+ * status_imp - 输出上一个前台作业的退出状态，以及管道中每一段的退出状态
+ */
+int status_imp(int argc, char *argv[]) {
+    printf("%d", last_status);
+    if (last_npipe > 1) {
+        printf(" (");
+        for (int i = 0; i < last_npipe; i++) {
+            printf(i ? " %d" : "%d", last_pipestatus[i]);
+        }
+        printf(")");
+    }
+    printf("\n");
+    return 0;
+}
+
+/**
+ * hash_imp - 管理命令路径的缓存：没有参数时列出缓存的命令，
+ * hash -r 清空缓存，hash 命令... 重新查找这些命令并加入缓存
+ */
+int hash_imp(int argc, char *argv[]) {
+    if (argc == 1) {
+        cmdhash_list();
+        return 0;
+    }
+    if (strcmp(argv[1], "-r") == 0) {
+        cmdhash_reset();
+        return 0;
+    }
+    int ret = 0;
+    for (int i = 1; i < argc; i++) {
+        if (cmdhash_add(argv[i]) < 0) {
+            fprintf(stderr, "hash: %s: 未找到\n", argv[i]);
+            ret = 1;
+        }
+    }
+    return ret;
 }
 
 /**
  * umask_imp - 设置创建文件时的权限，如果没有参数，则输出当前的设置
  */
-void umask_imp(char *argv[]) {
+int umask_imp(int argc, char *argv[]) {
     if (argv[1] == NULL) {  // 没有参数，输出当前的设置
         printf("%u\n", mode);
-        return;
+        return 0;
     }
     // 判断传入参数是否合法
     int len = strlen(argv[1]);
     if (len > 4) {
         fprintf(stderr, "参数太长：最多三位\n");
-        return;
+        return 1;
     }
     for (int i = len - 1; i >= 0; i--) {
         if (argv[1][i] < '0' && argv[1][i] > '7') {
             fprintf(stderr, "参数不合法，每一位只能为 0 到 7\n");
-            return;
+            return 1;
         }
     }
     // 设置
     mode = atoi(argv[1]);
     umask(mode);
+    return 0;
 }
-
-/**
- * is_valid_integer - 判断字符串 str 是否是合法的整数字符串
- */
-int is_valid_integer(char *str) {
-    while (*str) {
-        if (*str < '0' || *str > '9') {
-            return 0;
-        }
-        str++;
-    }
-    return 1;
-}
-/**
- * test_imp - test 的实现，只实现关于整数的比较
- * -gt : 大于 -ge : 大于等于
- * -lt : 小于 -le : 小于等于
- * -eq : 等于 -ne : 不等于
- */
-void test_imp(int argc, char *argv[]) {
-    if (argc > 4) {
-        fprintf(stderr, "test: 参数太多\n");
-        return;
-    } else if (argc < 4) {
-        fprintf(stderr, "test: 只支持二元表达式\n");
-        return;
-    }
-
-    if (!is_valid_integer(argv[1])) {
-        fprintf(stderr, "%s: 需要整数表达式\n", argv[1]);
-        return;
-    }
-
-    if (!is_valid_integer(argv[3])) {
-        fprintf(stderr, "%s: 需要整数表达式\n", argv[3]);
-        return;
-    }
-
-    char op;
-    int operand1 = atoi(argv[1]);
-    int operand2 = atoi(argv[3]);
-    int ret;
-    
-    if (strcmp(argv[2], "-gt") == 0) {
-        ret = operand1 > operand2;
-    } else if (strcmp(argv[2], "-ge") == 0) {
-        ret = operand1 >= operand2;
-    } else if (strcmp(argv[2], "-lt") == 0) {
-        ret = operand1 < operand2;
-    } else if (strcmp(argv[2], "-le") == 0) {
-        ret = operand1 <= operand2;
-    } else if (strcmp(argv[2], "-eq") == 0) {
-        ret = operand1 == operand2;
-    } else if (strcmp(argv[2], "-ne") == 0) {
-        ret = operand1 != operand2;
-    } else {
-        fprintf(stderr, "%s: 未知操作符\n", argv[2]);
-        return;
-    }
-
-    printf("%s\n", ret ? "true" : "false");
-}
\ No newline at end of file
@@ -1,19 +1,75 @@
 #ifndef __BUILT_IN_COMMAND_H_
-#define __BUILD_IN_COMMAND_H_
+#define __BUILT_IN_COMMAND_H_
+
+#include <sys/types.h>
 
 struct cmd;
-void cd_imp(const char *dir_path);
-void dir_imp(char *dir_path);
-void echo_imp(char *argv[]);
+
+/**
+ * 内部命令的函数，参数与 main 相同，返回退出状态
+ */
+typedef int builtin_fn(int argc, char *argv[]);
+
+#define BI_PARENT 1     // 必须在 shell 进程中运行才有效果，如 cd
+#define BI_PIPE 2       // 可以作为管道中的一段，在子进程中运行
+#define BI_ASYNC 4      // 以 & 运行时仍在 shell 进程中运行，由它自己管理创建的后台作业
+#define BI_RAWFD 8      // 直接读写描述符 0 和 1，不经过 stdio，命令替换时不能在 shell 进程中运行
+
+/**
+ * 内部命令表中的一项
+ */
+struct builtin {
+    const char *name;
+    builtin_fn *fn;
+    int flags;
+};
+
+/**
+ * builtin_hash - 内部命令表使用的哈希函数（带种子的 FNV-1a），
+ * mkbuiltins 在编译时寻找使所有名字都不冲突的种子
+ */
+static inline unsigned int builtin_hash(const char *name, unsigned int seed) {
+    unsigned int h = 2166136261u ^ seed;
+    while (*name) {
+        h = (h ^ (unsigned char)*name++) * 16777619u;
+    }
+    return h ^ (h >> 16);   // 低位只与种子的低位有关，需要混入高位
+}
+
+const struct builtin *builtin_lookup(const char *name);
+int builtin_register(const char *name, builtin_fn *fn, int flags);
+
+int cd_imp(int argc, char *argv[]);
+int dir_imp(int argc, char *argv[]);
+int echo_imp(int argc, char *argv[]);
 void exec_imp(struct cmd *command);
-void clr_imp(void);
-void time_imp();
-void help_imp(void);
-void set_imp(void);
-void umask_imp(char *argv[]);
-void test_imp(int argc, char *argv[]);
+int exec_builtin(int argc, char *argv[]);
+int exit_imp(int argc, char *argv[]);
+int clr_imp(int argc, char *argv[]);
+int time_imp(int argc, char *argv[]);
+int help_imp(int argc, char *argv[]);
+int set_imp(int argc, char *argv[]);
+int export_imp(int argc, char *argv[]);
+int status_imp(int argc, char *argv[]);
+int stats_imp(int argc, char *argv[]);
+int hash_imp(int argc, char *argv[]);
+int umask_imp(int argc, char *argv[]);
+int unset_imp(int argc, char *argv[]);
+int test_imp(int argc, char *argv[]);
+int bracket_imp(int argc, char *argv[]);
+int parallel_imp(int argc, char *argv[]);
+int scat_imp(int argc, char *argv[]);
+int stee_imp(int argc, char *argv[]);
+int true_imp(int argc, char *argv[]);
+int false_imp(int argc, char *argv[]);
+int break_imp(int argc, char *argv[]);
+int continue_imp(int argc, char *argv[]);
+int pwd_imp(int argc, char *argv[]);
+int jobs_imp(int argc, char *argv[]);
 int fg_imp(int argc, char *argv[]);
-void waitfg();
+void waitfg(pid_t pgid);
 int bg_imp(int argc, char *argv[]);
+int kill_imp(int argc, char *argv[]);
+void promote_queued(void);
 
-#endif
\ No newline at end of file
+#endif
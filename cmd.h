@@ -0,0 +1,124 @@
+#ifndef __CMD_H_
+#define __CMD_H_
+
+#include "arena.h"
+
+#define EXPAND_IN 1
+#define EXPAND_OUT 2
+
+/**
+ * 命令的种类，EXEC 为正常运行，PIPE 为管道，REDIR 为重定向，
+ * 之后的为复合命令：LIST 为一串命令，IF、WHILE 和 FOR 为控制结构
+ */
+enum cmd_type { EXEC, PIPE, REDIR, LIST, IF, WHILE, FOR };
+
+/**
+ * 表示命令的结构体，模拟 C++ 的继承
+ */
+struct cmd {
+    enum cmd_type type;
+    int fgbg;
+};
+
+/**
+ * 直接运行的命令的结构体，type 一定为 EXEC
+ */
+struct execcmd {
+    enum cmd_type type;
+    int fgbg;
+    int argc;
+    char **argv;    // 以 NULL 结尾，参数的个数没有限制，从内存池中分配
+    int nassign;    // 开头的变量赋值 name=value 的个数
+    unsigned char *expand;  // expand[i] 非零表示 argv[i] 为带引号的原始单词，运行前需要展开，
+                            // 没有需要展开的参数时为 NULL
+    char **assign;  // 展开之后的 nassign 个赋值，这时 argv 中不再包含它们；
+                    // 解析得到的命令树中为 NULL，赋值仍然在 argv 的开头
+};
+
+/**
+ * 管道命令的结构体，type 一定为 PIPE
+ */
+struct pipecmd {
+    enum cmd_type type;
+    int fgbg;
+    struct cmd *left;
+    struct cmd *right;
+};
+
+/**
+ * 管理重定向命令的结构体，type 一定为 REDIR
+ */
+struct redircmd {
+    enum cmd_type type;
+    int fgbg;
+    struct cmd *command;
+    int mode;   // 追加或截断
+    char *in_file;  // 输入重定向的文件，NULL 表示没有
+    char *out_file; // 输出重定向的文件，NULL 表示没有
+    int expand;     // 需要展开的文件名，EXPAND_IN 和 EXPAND_OUT 的组合
+};
+
+/**
+ * 一串依次运行的命令，type 一定为 LIST。简单命令（EXEC、PIPE、REDIR）在 cmdlines 中
+ * 有对应的命令行，作为作业的命令行；复合命令的 cmdlines[i] 为 NULL
+ */
+struct listcmd {
+    enum cmd_type type;
+    int fgbg;
+    int n;
+    int cap;
+    struct cmd **cmds;
+    char **cmdlines;
+};
+
+/**
+ * if 命令的结构体，type 一定为 IF，elif 表示为 else 中嵌套的 IF
+ */
+struct ifcmd {
+    enum cmd_type type;
+    int fgbg;
+    struct cmd *cond;
+    struct cmd *then;
+    struct cmd *els;    // 没有 else 时为 NULL
+};
+
+/**
+ * while 循环的结构体，type 一定为 WHILE
+ */
+struct whilecmd {
+    enum cmd_type type;
+    int fgbg;
+    struct cmd *cond;
+    struct cmd *body;
+};
+
+/**
+ * for 循环的结构体，type 一定为 FOR
+ */
+struct forcmd {
+    enum cmd_type type;
+    int fgbg;
+    char *name;     // 循环变量
+    struct execcmd *words;  // in 之后的单词，与命令的参数一样展开；没有 in 时为 NULL，使用位置参数
+    struct cmd *body;
+};
+
+/**
+ * 复合命令没有结束时由 more 读入下一行，没有更多输入时返回 NULL
+ */
+typedef const char *(*more_fn)(void *ctx);
+
+struct cmd *parsecmd(struct arena *a, const char *cmd, more_fn more, void *ctx);
+struct cmd *parseline(struct arena *a, struct arena *scratch, const char *cmd,
+                      more_fn more, void *ctx, const char **err);
+struct cmd *create_pipecmd(struct arena *a, struct cmd *left, struct cmd *right);
+struct cmd *create_execcmd(struct arena *a, int argc, char **argv);
+struct cmd *create_redircmd(struct arena *a, struct cmd *inner_command, int mode,
+                            char *in_file, char *out_file);
+struct listcmd *create_listcmd(struct arena *a);
+void list_add(struct arena *a, struct listcmd *list, struct cmd *command, char *cmdline);
+struct cmd *create_ifcmd(struct arena *a, struct cmd *cond, struct cmd *then, struct cmd *els);
+struct cmd *create_whilecmd(struct arena *a, struct cmd *cond, struct cmd *body);
+struct cmd *create_forcmd(struct arena *a, char *name, struct execcmd *words, struct cmd *body);
+
+#endif
@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cmdhash.h"
+#include "var.h"
+
+#define INIT_BUCKETS 64
+
+/**
+ * 命令名到完整路径的映射，path 为 NULL 表示在 PATH 中找不到该命令（负缓存）
+ */
+struct cmd_entry {
+    char *name;
+    char *path;
+    int hits;               // 命中的次数
+    struct cmd_entry *next;
+};
+
+static struct cmd_entry **buckets = NULL;
+static int nbuckets = 0;
+static int nentries = 0;
+static char *cached_path = NULL;    // 建立缓存时 PATH 的值，PATH 改变时清空缓存
+
+/**
+ * hash_name - FNV-1a 哈希
+ */
+static unsigned int hash_name(const char *name) {
+    unsigned int h = 2166136261u;
+    while (*name) {
+        h = (h ^ (unsigned char)*name++) * 16777619u;
+    }
+    return h;
+}
+
+/**
+ * free_entries - 释放所有的表项，但保留桶数组
+ */
+static void free_entries(void) {
+    struct cmd_entry *entry, *next;
+    for (int i = 0; i < nbuckets; i++) {
+        for (entry = buckets[i]; entry; entry = next) {
+            next = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+        }
+        buckets[i] = NULL;
+    }
+    nentries = 0;
+}
+
+/**
+ * check_path - 若 PATH 自上次查找之后被修改，则清空缓存
+ */
+static void check_path(void) {
+    const char *path = var_get("PATH");
+    if (path == NULL) {
+        path = "";
+    }
+    if (cached_path != NULL && strcmp(cached_path, path) == 0) {
+        return;
+    }
+    free(cached_path);
+    cached_path = strdup(path);
+    free_entries();
+}
+
+/**
+ * grow - 表项数量超过桶的数量时，将桶的数量加倍
+ */
+static void grow(void) {
+    int n = nbuckets ? nbuckets * 2 : INIT_BUCKETS;
+    struct cmd_entry **table = (struct cmd_entry **)calloc(n, sizeof(struct cmd_entry *));
+    struct cmd_entry *entry, *next;
+    for (int i = 0; i < nbuckets; i++) {
+        for (entry = buckets[i]; entry; entry = next) {
+            next = entry->next;
+            unsigned int h = hash_name(entry->name) & (n - 1);
+            entry->next = table[h];
+            table[h] = entry;
+        }
+    }
+    free(buckets);
+    buckets = table;
+    nbuckets = n;
+}
+
+/**
+ * find_entry - 在缓存中查找 name，返回表项的指针的地址，便于删除
+ */
+static struct cmd_entry **find_entry(const char *name) {
+    struct cmd_entry **pp;
+    if (nbuckets == 0) {
+        return NULL;
+    }
+    for (pp = &buckets[hash_name(name) & (nbuckets - 1)]; *pp; pp = &(*pp)->next) {
+        if (strcmp((*pp)->name, name) == 0) {
+            return pp;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * search_path - 依次在 PATH 的每一个目录中查找可执行的普通文件 name，
+ * 找到时返回新分配的完整路径，否则返回 NULL
+ */
+static char *search_path(const char *name) {
+    const char *dir = cached_path;
+    size_t namelen = strlen(name);
+    struct stat buf;
+
+    while (*dir) {
+        const char *end = strchr(dir, ':');
+        size_t dirlen = end ? (size_t)(end - dir) : strlen(dir);
+        char *full = (char *)malloc(dirlen + namelen + 3);
+        if (dirlen == 0) {  // 空目录表示当前目录
+            full[0] = '.';
+            dirlen = 1;
+        } else {
+            memcpy(full, dir, dirlen);
+        }
+        full[dirlen] = '/';
+        memcpy(full + dirlen + 1, name, namelen + 1);
+        if (stat(full, &buf) == 0 && S_ISREG(buf.st_mode) && access(full, X_OK) == 0) {
+            return full;
+        }
+        free(full);
+        if (end == NULL) {
+            break;
+        }
+        dir = end + 1;
+    }
+    return NULL;
+}
+
+/**
+ * insert - 在 PATH 中查找 name，并将结果（包括找不到的结果）加入缓存
+ */
+static struct cmd_entry *insert(const char *name) {
+    struct cmd_entry *entry = (struct cmd_entry *)malloc(sizeof(struct cmd_entry));
+    if (nentries >= nbuckets) {
+        grow();
+    }
+    entry->name = strdup(name);
+    entry->path = search_path(name);
+    entry->hits = 0;
+    unsigned int h = hash_name(name) & (nbuckets - 1);
+    entry->next = buckets[h];
+    buckets[h] = entry;
+    nentries++;
+    return entry;
+}
+
+/**
+ * cmdhash_lookup - 返回命令 name 的完整路径，包含 '/' 的命令直接返回，
+ * 其余的命令先查找缓存，缓存中没有时搜索 PATH 并记录结果，
+ * 命令不存在时返回 NULL，返回的字符串由缓存管理
+ */
+const char *cmdhash_lookup(const char *name) {
+    if (strchr(name, '/') != NULL) {
+        return name;
+    }
+    check_path();
+    struct cmd_entry **pp = find_entry(name);
+    struct cmd_entry *entry = pp ? *pp : insert(name);
+    entry->hits++;
+    return entry->path;
+}
+
+/**
+ * cmdhash_forget - 删除 name 的缓存，用于缓存的路径已经失效的情况
+ */
+void cmdhash_forget(const char *name) {
+    struct cmd_entry **pp = find_entry(name);
+    if (pp == NULL) {
+        return;
+    }
+    struct cmd_entry *entry = *pp;
+    *pp = entry->next;
+    free(entry->name);
+    free(entry->path);
+    free(entry);
+    nentries--;
+}
+
+/**
+ * cmdhash_add - 重新查找 name 并加入缓存，找不到时返回 -1
+ */
+int cmdhash_add(const char *name) {
+    check_path();
+    cmdhash_forget(name);
+    return insert(name)->path ? 0 : -1;
+}
+
+/**
+ * cmdhash_reset - 清空缓存
+ */
+void cmdhash_reset(void) {
+    free_entries();
+}
+
+/**
+ * cmdhash_list - 输出缓存中所有找到的命令
+ */
+void cmdhash_list(void) {
+    struct cmd_entry *entry;
+    int empty = 1;
+    for (int i = 0; i < nbuckets; i++) {
+        for (entry = buckets[i]; entry; entry = entry->next) {
+            if (entry->path == NULL) {
+                continue;
+            }
+            if (empty) {
+                printf("命中\t命令\n");
+                empty = 0;
+            }
+            printf("%4d\t%s\n", entry->hits, entry->path);
+        }
+    }
+    if (empty) {
+        printf("hash: 哈希表为空\n");
+    }
+}
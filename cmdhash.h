@@ -0,0 +1,10 @@
+#ifndef __CMDHASH_H_
+#define __CMDHASH_H_
+
+const char *cmdhash_lookup(const char *name);
+void cmdhash_forget(const char *name);
+int cmdhash_add(const char *name);
+void cmdhash_reset(void);
+void cmdhash_list(void);
+
+#endif
@@ -0,0 +1,539 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "expand.h"
+#include "arith.h"
+#include "cmd.h"
+#include "var.h"
+
+extern int last_status;
+
+/**
+ * 可以增长的字符串，由 malloc 分配
+ */
+struct strbuf {
+    char *s;
+    size_t len;
+    size_t cap;
+};
+
+/**
+ * 一个单词展开的结果：未加引号的展开的值按空白分割为多个字段
+ */
+struct fields {
+    struct arena *a;
+    char **v;           // 已经完成的字段，从 a 中分配
+    int n;
+    int cap;
+    struct strbuf cur;  // 正在构造的字段
+    int started;        // 当前字段是否存在，"" 这样的空字段也存在，而展开为空的 $x 不存在
+    int split;          // 是否分割字段，赋值和重定向的文件名不分割
+    int failed;         // 展开出错，如算术表达式错误，这时命令不能运行
+};
+
+static void expand_into(struct fields *f, const char *p, const char *end);
+
+static void sb_put(struct strbuf *b, const char *s, size_t n) {
+    if (b->len + n + 1 > b->cap) {
+        b->cap = b->cap ? b->cap * 2 : 64;
+        if (b->cap < b->len + n + 1) {
+            b->cap = b->len + n + 1;
+        }
+        b->s = (char *)realloc(b->s, b->cap);
+    }
+    memcpy(b->s + b->len, s, n);
+    b->len += n;
+    b->s[b->len] = '\0';
+}
+
+static void put_char(struct fields *f, char c) {
+    sb_put(&f->cur, &c, 1);
+    f->started = 1;
+}
+
+/**
+ * end_field - 结束当前的字段，存在时加入结果
+ */
+static void end_field(struct fields *f) {
+    if (!f->started) {
+        return;
+    }
+    if (f->n == f->cap) {
+        f->cap = f->cap ? f->cap * 2 : 8;
+        f->v = (char **)realloc(f->v, f->cap * sizeof(char *));
+    }
+    f->v[f->n++] = arena_strndup(f->a, f->cur.s ? f->cur.s : "", f->cur.len);
+    f->cur.len = 0;
+    f->started = 0;
+}
+
+/**
+ * emit - 将展开的值加入结果，未加引号时按空格、制表符和换行符分割
+ */
+static void emit(struct fields *f, const char *value, size_t len, int quoted) {
+    if (quoted || !f->split) {
+        sb_put(&f->cur, value, len);
+        f->started = 1;
+        return;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (value[i] == ' ' || value[i] == '\t' || value[i] == '\n') {
+            end_field(f);
+        } else {
+            put_char(f, value[i]);
+        }
+    }
+}
+
+/**
+ * param_value - 返回参数 name 的值，未设置时返回 NULL。特殊参数 $? $$ $# 的值写入 num 中
+ */
+const char *param_value(const char *name, char *num, size_t size) {
+    if (name[0] >= '0' && name[0] <= '9') {
+        return var_arg(atoi(name));
+    }
+    if (name[1] == '\0') {
+        switch (name[0]) {
+            case '?':
+                snprintf(num, size, "%d", last_status);
+                return num;
+            case '$':
+                snprintf(num, size, "%d", (int)getpid());
+                return num;
+            case '#':
+                snprintf(num, size, "%d", var_nargs());
+                return num;
+        }
+    }
+    return var_get(name);
+}
+
+/**
+ * param_len - 返回 p 开始的参数名的长度：变量名、一个数字或者 ? $ # 之一，不是参数名时返回 0
+ */
+static size_t param_len(const char *p, const char *end) {
+    size_t n = 0;
+    if (p >= end) {
+        return 0;
+    }
+    if (strchr("?$#0123456789", *p) != NULL) {
+        return 1;
+    }
+    while (p + n < end && var_isname(p, n + 1)) {
+        n++;
+    }
+    return n;
+}
+
+/**
+ * word_value - 展开 ${name:-word} 等形式中的 word，不分割字段，结果从 f->a 中分配
+ */
+static char *word_value(struct fields *f, const char *p, const char *end) {
+    struct fields w = { f->a, NULL, 0, 0, { NULL, 0, 0 }, 1, 0 };
+    expand_into(&w, p, end);
+    f->failed |= w.failed;
+    char *value = w.n ? w.v[0] : arena_strndup(f->a, w.cur.s ? w.cur.s : "", w.cur.len);
+    free(w.v);
+    free(w.cur.s);
+    return value;
+}
+
+/**
+ * eval_num - 求出 ${name:off:len} 中的 off 或 len：整数，或者值为整数的变量
+ */
+static long eval_num(struct fields *f, const char *p, const char *end) {
+    char *s = word_value(f, p, end);
+    while (*s == ' ' || *s == '\t') {
+        s++;
+    }
+    if (var_isname(s, strlen(s))) {
+        s = (char *)var_get(s);
+        if (s == NULL) {
+            return 0;
+        }
+    }
+    return strtol(s, NULL, 10);
+}
+
+/**
+ * find_close - 返回 p 之后与 ${ 匹配的 } 的位置，没有时返回 end
+ */
+static const char *find_close(const char *p, const char *end) {
+    int depth = 1;
+    for (; p < end; p++) {
+        if (*p == '\\' && p + 1 < end) {
+            p++;
+        } else if (*p == '{') {
+            depth++;
+        } else if (*p == '}' && --depth == 0) {
+            break;
+        }
+    }
+    return p;
+}
+
+/**
+ * find_paren - 返回 p 之后与 ( 匹配的 ) 的位置，跳过引号中的内容，没有时返回 end
+ */
+static const char *find_paren(const char *p, const char *end) {
+    int depth = 1;
+    for (; p < end; p++) {
+        if (*p == '\\' && p + 1 < end) {
+            p++;
+        } else if (*p == '\'' || *p == '"') {
+            const char *q = memchr(p + 1, *p, end - p - 1);
+            p = q != NULL ? q : end - 1;
+        } else if (*p == '(') {
+            depth++;
+        } else if (*p == ')' && --depth == 0) {
+            break;
+        }
+    }
+    return p;
+}
+
+/**
+ * is_simple_arith - 判断算术表达式 [p, end) 中的 $ 是否都是 $name、${name} 或特殊参数，
+ * 这时由算术表达式自己读取变量，文本不随变量的值变化，编译的结果可以重复使用
+ */
+static int is_simple_arith(const char *p, const char *end) {
+    for (; p < end; p++) {
+        if (*p == '`' || *p == '\\' || *p == '\'' || *p == '"' || (*p == '$' && p + 1 < end && p[1] == '(')) {
+            return 0;
+        }
+        if (*p == '$' && p + 1 < end && p[1] == '{') {
+            const char *close = find_close(p + 2, end);
+            if (!var_isname(p + 2, close - p - 2)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/**
+ * expand_arith - 展开 $((...))，p 和 end 为表达式。表达式中有其他形式的展开时先展开它们
+ */
+static void expand_arith(struct fields *f, const char *p, const char *end, int quoted) {
+    char num[32];
+    long value;
+    if (!is_simple_arith(p, end)) {
+        char *text = word_value(f, p, end);
+        p = text;
+        end = text + strlen(text);
+    }
+    if (arith_eval(p, end - p, &value) < 0) {
+        f->failed = 1;
+        return;
+    }
+    snprintf(num, sizeof(num), "%ld", value);
+    emit(f, num, strlen(num), quoted);
+}
+
+/**
+ * expand_subst - 展开命令替换，[p, end) 为命令的文本，输出去掉末尾的换行符后加入结果
+ */
+static void expand_subst(struct fields *f, const char *p, const char *end, int quoted) {
+    size_t len;
+    char *out = cmdsubst(p, end - p, &len);
+    while (len > 0 && out[len - 1] == '\n') {
+        len--;
+    }
+    emit(f, out, len, quoted);
+    free(out);
+}
+
+/**
+ * expand_backquote - 展开 `...`，p 指向 ` 之后的字符，返回结束的 ` 之后的位置。
+ * 其中的 \$ \` \\ 去掉反斜杠后才是命令的文本
+ */
+static const char *expand_backquote(struct fields *f, const char *p, const char *end, int quoted) {
+    struct strbuf text = { NULL, 0, 0 };
+    for (; p < end && *p != '`'; p++) {
+        if (*p == '\\' && p + 1 < end && strchr("$`\\", p[1])) {
+            p++;
+        }
+        sb_put(&text, p, 1);
+    }
+    expand_subst(f, text.s, text.s + text.len, quoted);
+    free(text.s);
+    return p < end ? p + 1 : end;
+}
+
+/**
+ * expand_brace - 展开 ${...}，p 和 end 为大括号中的内容。支持的形式有：
+ *   ${name}            变量的值
+ *   ${#name}           值的长度（字节数）
+ *   ${name:off}        从 off 开始的子串，off 为负数时从末尾开始计算
+ *   ${name:off:len}    从 off 开始的 len 个字节，len 为负数时表示去掉末尾的 -len 个字节
+ *   ${name-word}       未设置时为 word，带冒号时值为空也视为未设置，下同
+ *   ${name=word}       未设置时将 name 设置为 word
+ *   ${name+word}       已设置时为 word，否则为空
+ */
+static void expand_brace(struct fields *f, const char *p, const char *end, int quoted) {
+    char num[32], *name;
+    const char *value, *q, *start = p;   // start 用于在错误信息中输出整个 ${...}
+    int length = 0, colon = 0;
+
+    if (p < end && *p == '#' && end - p > 1) {  // ${#name}
+        length = 1;
+        p++;
+    }
+    size_t n = param_len(p, end);
+    if (n == 0) {
+        goto bad;
+    }
+    name = arena_strndup(f->a, p, n);
+    value = param_value(name, num, sizeof(num));
+    p += n;
+    if (length) {
+        if (p != end) {
+            goto bad;
+        }
+        snprintf(num, sizeof(num), "%zu", value ? strlen(value) : 0);
+        emit(f, num, strlen(num), quoted);
+        return;
+    }
+    if (p == end) {
+        if (value != NULL) {
+            emit(f, value, strlen(value), quoted);
+        }
+        return;
+    }
+    if (*p == ':' && (p + 1 == end || strchr("-=+", p[1]) == NULL)) {    // 子串
+        size_t vlen = value ? strlen(value) : 0;
+        for (q = ++p; q < end && *q != ':'; q++) {
+        }
+        long off = eval_num(f, p, q);
+        long stop = vlen;
+        if (off < 0) {
+            off += vlen;
+        }
+        if (q < end) {
+            long len = eval_num(f, q + 1, end);
+            stop = len < 0 ? (long)vlen + len : off + len;
+        }
+        if (stop > (long)vlen) {
+            stop = vlen;
+        }
+        if (off >= 0 && off < stop) {
+            emit(f, value + off, stop - off, quoted);
+        }
+        return;
+    }
+    if (*p == ':') {
+        colon = 1;
+        p++;
+    }
+    char op = *p++;
+    int set = value != NULL && !(colon && *value == '\0');
+    switch (op) {
+        case '-':
+            if (!set) {
+                value = word_value(f, p, end);
+            }
+            break;
+        case '=':
+            if (!set) {
+                if (!var_isname(name, strlen(name))) {
+                    fprintf(stderr, "myshell: %s: 不能这样赋值\n", name);
+                    f->failed = 1;
+                    return;
+                }
+                value = word_value(f, p, end);
+                if (f->failed) {    // word 展开出错时不赋值
+                    return;
+                }
+                var_set(name, value);
+            }
+            break;
+        case '+':
+            value = set ? word_value(f, p, end) : NULL;
+            break;
+        default:
+            goto bad;
+    }
+    if (value != NULL) {
+        emit(f, value, strlen(value), quoted);
+    }
+    return;
+
+bad:
+    fprintf(stderr, "myshell: ${%.*s}: 错误的替换\n", (int)(end - start), start);
+    f->failed = 1;
+}
+
+/**
+ * expand_dollar - 展开 $ 之后的参数，p 指向 $ 之后的字符，返回展开之后的位置
+ */
+static const char *expand_dollar(struct fields *f, const char *p, const char *end, int quoted) {
+    char num[32];
+    if (end - p >= 2 && p[0] == '(' && p[1] == '(') {
+        // 内层的括号到倒数第二个 ) 为止时为 $((...))，否则为 $( (...) ... )
+        const char *close = find_paren(p + 1, end);
+        if (close < end && find_paren(p + 2, end) == close - 1) {
+            expand_arith(f, p + 2, close - 1, quoted);
+            return close + 1;
+        }
+    }
+    if (p < end && *p == '(') {     // $(...)
+        const char *close = find_paren(p + 1, end);
+        expand_subst(f, p + 1, close, quoted);
+        return close < end ? close + 1 : end;
+    }
+    if (p < end && *p == '{') {
+        const char *close = find_close(p + 1, end);
+        expand_brace(f, p + 1, close, quoted);
+        return close < end ? close + 1 : end;
+    }
+    size_t n = param_len(p, end);
+    if (n == 0) {   // 不是参数，$ 原样保留
+        put_char(f, '$');
+        return p;
+    }
+    char *name = arena_strndup(f->a, p, n);
+    const char *value = param_value(name, num, sizeof(num));
+    if (value != NULL) {
+        emit(f, value, strlen(value), quoted);
+    } else if (quoted) {
+        f->started = 1;
+    }
+    return p + n;
+}
+
+/**
+ * expand_into - 展开原始单词 [p, end)，去掉引号和转义用的反斜杠，
+ * 引号的规则与 lex_word 相同，单引号之外的 $ 在这里展开
+ */
+static void expand_into(struct fields *f, const char *p, const char *end) {
+    while (p < end) {
+        if (*p == '\\') {
+            p++;
+            if (p < end) {
+                put_char(f, *p++);
+            }
+        } else if (*p == '\'') {
+            f->started = 1;
+            for (p++; p < end && *p != '\''; p++) {
+                put_char(f, *p);
+            }
+            p++;
+        } else if (*p == '"') {
+            f->started = 1;
+            p++;
+            while (p < end && *p != '"') {
+                if (*p == '\\' && p + 1 < end && strchr("\"\\$`", p[1])) {
+                    put_char(f, p[1]);
+                    p += 2;
+                } else if (*p == '$') {
+                    p = expand_dollar(f, p + 1, end, 1);
+                } else if (*p == '`') {
+                    p = expand_backquote(f, p + 1, end, 1);
+                } else {
+                    put_char(f, *p++);
+                }
+            }
+            p++;
+        } else if (*p == '$') {
+            p = expand_dollar(f, p + 1, end, 0);
+        } else if (*p == '`') {
+            p = expand_backquote(f, p + 1, end, 0);
+        } else {
+            put_char(f, *p++);
+        }
+    }
+}
+
+/**
+ * expand_word - 展开一个原始单词，不分割字段，结果从 a 中分配，展开出错时返回 NULL
+ */
+char *expand_word(struct arena *a, const char *raw) {
+    struct fields f = { a, NULL, 0, 0, { NULL, 0, 0 }, 0, 0 };
+    char *value = word_value(&f, raw, raw + strlen(raw));
+    return f.failed ? NULL : value;
+}
+
+/**
+ * expand_argv - 展开 exec_cmd 的参数，需要展开的单词可能变为多个参数，也可能消失，
+ * 开头的变量赋值不分割字段。返回新的参数个数，*argv 指向从 a 中分配的以 NULL 结尾的数组，
+ * 展开出错时返回 -1
+ */
+static int expand_argv(struct arena *a, struct execcmd *exec_cmd, char ***argv) {
+    struct fields f = { a, NULL, 0, 0, { NULL, 0, 0 }, 0, 1 };
+    for (int i = 0; i < exec_cmd->argc; i++) {
+        if (exec_cmd->expand == NULL || !exec_cmd->expand[i]) {
+            f.started = 1;
+            sb_put(&f.cur, exec_cmd->argv[i], strlen(exec_cmd->argv[i]));
+        } else {
+            f.split = i >= exec_cmd->nassign;
+            expand_into(&f, exec_cmd->argv[i], exec_cmd->argv[i] + strlen(exec_cmd->argv[i]));
+        }
+        end_field(&f);
+    }
+    *argv = (char **)arena_alloc(a, (f.n + 1) * sizeof(char *));
+    memcpy(*argv, f.v, f.n * sizeof(char *));
+    (*argv)[f.n] = NULL;
+    free(f.v);
+    free(f.cur.s);
+    return f.failed ? -1 : f.n;
+}
+
+/**
+ * expandcmd - 在运行之前展开命令树中的参数和重定向的文件名，返回从 a 中分配的新的命令树。
+ * 原来的命令树不会被修改，因此脚本中的命令可以多次运行。展开出错时返回 NULL，命令不能运行
+ */
+struct cmd *expandcmd(struct arena *a, struct cmd *command) {
+    struct cmd *result = NULL;
+    switch (command->type) {
+        case EXEC: {
+            struct execcmd *exec_cmd = (struct execcmd *)command;
+            char **argv;
+            if (exec_cmd->expand == NULL) {     // 只需要复制参数的数组
+                argv = (char **)arena_alloc(a, (exec_cmd->argc + 1) * sizeof(char *));
+                memcpy(argv, exec_cmd->argv, (exec_cmd->argc + 1) * sizeof(char *));
+                result = create_execcmd(a, exec_cmd->argc, argv);
+            } else {    // 开头的赋值各自展开为一个单词，从参数中分离出来
+                int argc = expand_argv(a, exec_cmd, &argv);
+                if (argc < 0) {
+                    return NULL;
+                }
+                result = create_execcmd(a, argc - exec_cmd->nassign, argv + exec_cmd->nassign);
+                if (exec_cmd->nassign) {
+                    ((struct execcmd *)result)->nassign = exec_cmd->nassign;
+                    ((struct execcmd *)result)->assign = argv;
+                }
+            }
+            break;
+        }
+        case PIPE: {
+            struct pipecmd *pipe_cmd = (struct pipecmd *)command;
+            struct cmd *left = expandcmd(a, pipe_cmd->left);
+            struct cmd *right = left ? expandcmd(a, pipe_cmd->right) : NULL;
+            if (right == NULL) {
+                return NULL;
+            }
+            result = create_pipecmd(a, left, right);
+            break;
+        }
+        case REDIR: {
+            struct redircmd *redir_cmd = (struct redircmd *)command;
+            char *in_file = redir_cmd->in_file, *out_file = redir_cmd->out_file;
+            if ((redir_cmd->expand & EXPAND_IN) && (in_file = expand_word(a, in_file)) == NULL) {
+                return NULL;
+            }
+            if ((redir_cmd->expand & EXPAND_OUT) && (out_file = expand_word(a, out_file)) == NULL) {
+                return NULL;
+            }
+            struct cmd *sub = expandcmd(a, redir_cmd->command);
+            if (sub == NULL) {
+                return NULL;
+            }
+            result = create_redircmd(a, sub, redir_cmd->mode, in_file, out_file);
+            break;
+        }
+    }
+    result->fgbg = command->fgbg;
+    return result;
+}
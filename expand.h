@@ -0,0 +1,15 @@
+#ifndef __EXPAND_H_
+#define __EXPAND_H_
+
+#include <stddef.h>
+
+struct cmd;
+struct arena;
+
+struct cmd *expandcmd(struct arena *a, struct cmd *command);
+char *expand_word(struct arena *a, const char *raw);
+const char *param_value(const char *name, char *num, size_t size);
+// 命令替换，由 myshell.c 实现
+char *cmdsubst(const char *text, size_t len, size_t *outlen);
+
+#endif
@@ -0,0 +1,468 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "jobs.h"
+
+#define INIT_JOBS 64
+
+/**
+ * 进程号索引中的一项，管道中每一段的进程都有一项，pid 为 0 表示空位。
+ * 使用线性探测的开放寻址，删除时向前移动后面的项，不需要墓碑，
+ * 因此删除不会分配内存
+ */
+struct pid_slot {
+    pid_t pid;
+    struct job_t *job;
+    struct proc_t *proc;    // 没有记录每一段进程的作业为 NULL
+};
+
+static struct job_t **jidtab = NULL;    // 以 jid 为下标的作业表
+static int jidcap = 0;
+static int nextjid = 1;     // 从未使用过的最小 jid
+static int *freejids = NULL;    // 已经释放、可以重新使用的 jid
+static int nfree = 0;
+static int count = 0;       // 作业的数量
+static struct job_t *freejobs = NULL;   // 已经删除的作业结构体，供 addjob 重新使用
+static int nbg = 0;         // BG 状态的作业数
+static int nqd = 0;         // QD 状态的作业数
+static struct job_t *qhead = NULL;      // 最早排队的作业
+static struct job_t *qtail = NULL;
+
+static struct pid_slot *pidtab = NULL;
+static int pidcap = 0;
+static int npids = 0;
+
+/**
+ * pid_hash - 相邻的进程号落在相邻的位置上
+ */
+static unsigned int pid_hash(pid_t pid) {
+    return (unsigned int)pid * 2654435761u & (pidcap - 1);
+}
+
+/**
+ * pid_find - 返回 pid 所在的位置，不存在时返回 -1
+ */
+static int pid_find(pid_t pid) {
+    if (pidcap == 0) {
+        return -1;
+    }
+    for (unsigned int i = pid_hash(pid); pidtab[i].pid != 0; i = (i + 1) & (pidcap - 1)) {
+        if (pidtab[i].pid == pid) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * pid_insert - 将 pid 加入索引，调用者保证还有空位
+ */
+static void pid_insert(pid_t pid, struct job_t *job, struct proc_t *proc) {
+    unsigned int i = pid_hash(pid);
+    while (pidtab[i].pid != 0) {
+        i = (i + 1) & (pidcap - 1);
+    }
+    pidtab[i].pid = pid;
+    pidtab[i].job = job;
+    pidtab[i].proc = proc;
+    npids++;
+}
+
+/**
+ * pid_remove - 从索引中删除 pid，将探测序列中后面的项前移填补空位
+ */
+static void pid_remove(pid_t pid) {
+    int i = pid_find(pid);
+    unsigned int j, k, mask = pidcap - 1;
+    if (i < 0) {
+        return;
+    }
+    npids--;
+    for (j = i;;) {
+        pidtab[i].pid = 0;
+        do {
+            j = (j + 1) & mask;
+            if (pidtab[j].pid == 0) {
+                return;
+            }
+            k = pid_hash(pidtab[j].pid);
+            // k 在 (i, j] 中时，该项不能移动到 i
+        } while ((unsigned int)i <= j ? ((unsigned int)i < k && k <= j) : ((unsigned int)i < k || k <= j));
+        pidtab[i] = pidtab[j];
+        i = j;
+    }
+}
+
+/**
+ * pid_reserve - 保证索引中还能放下 n 个进程，装载因子不超过 1/2
+ */
+static void pid_reserve(int n) {
+    struct pid_slot *old = pidtab;
+    int oldcap = pidcap;
+    if ((npids + n) * 2 <= pidcap) {
+        return;
+    }
+    while ((npids + n) * 2 > pidcap) {
+        pidcap = pidcap ? pidcap * 2 : INIT_JOBS * 2;
+    }
+    pidtab = (struct pid_slot *)calloc(pidcap, sizeof(struct pid_slot));
+    npids = 0;
+    for (int i = 0; i < oldcap; i++) {
+        if (old[i].pid != 0) {
+            pid_insert(old[i].pid, old[i].job, old[i].proc);
+        }
+    }
+    free(old);
+}
+
+/**
+ * alloc_jid - 优先使用空闲链表中的 jid，没有时使用新的 jid，必要时扩大作业表
+ */
+static int alloc_jid(void) {
+    if (nfree > 0) {
+        return freejids[--nfree];
+    }
+    if (nextjid >= jidcap) {
+        int n = jidcap ? jidcap * 2 : INIT_JOBS;
+        jidtab = (struct job_t **)realloc(jidtab, n * sizeof(struct job_t *));
+        memset(jidtab + jidcap, 0, (n - jidcap) * sizeof(struct job_t *));
+        freejids = (int *)realloc(freejids, n * sizeof(int));
+        jidcap = n;
+    }
+    return nextjid++;
+}
+
+/**
+ * addjob - 向作业表中添加一个 job，返回刚设置的结构体，
+ * pid 为作业的进程组号，procs 为管道中每一段的进程，
+ * arena 为命令的内存池，由作业负责释放，为 NULL 时直接引用 cmdline。
+ * 作业表和索引只在这里增长，删除作业不会分配内存
+ */
+struct job_t *addjob(char *cmdline, int bgfg, struct cmd *command, pid_t pid,
+                     struct proc_t *procs, int nproc, struct arena *arena) {
+    struct job_t *job = freejobs;
+    if (job != NULL) {
+        freejobs = job->next;
+    } else {
+        job = (struct job_t *)malloc(sizeof(struct job_t));
+    }
+    job->jid = alloc_jid();
+    job->state = INVALID;
+    job->pid = pid;
+    job->command = command;
+    job->procs = procs;
+    job->nproc = nproc;
+    job->nlive = nproc;
+    job->arena = arena;
+    job->cmdline = arena ? arena_strdup(arena, cmdline) : cmdline;
+    job->queue = NULL;
+    job->task = 0;
+    job->qprev = job->qnext = NULL;
+    job->next = NULL;
+    jidtab[job->jid] = job;
+    count++;
+    setjobstate(job, bgfg ? BG : FG);
+
+    pid_reserve(nproc + 1);
+    for (int i = 0; i < nproc; i++) {
+        if (procs[i].pid > 0) {
+            pid_insert(procs[i].pid, job, &procs[i]);
+        }
+    }
+    if (nproc == 0) {
+        pid_insert(pid, job, NULL);
+    }
+    return job;
+}
+
+/**
+ * setjobpids - 排队的作业创建了进程之后调用，记录进程组号 pid，并将每一段的进程号加入索引
+ */
+void setjobpids(struct job_t *job, pid_t pid) {
+    job->pid = pid;
+    pid_reserve(job->nproc);
+    for (int i = 0; i < job->nproc; i++) {
+        if (job->procs[i].pid > 0) {
+            pid_insert(job->procs[i].pid, job, &job->procs[i]);
+        }
+    }
+}
+
+/**
+ * deljob - 删除进程组号或者其中某一进程的进程号为 pid 的作业，
+ * 不分配内存，作业结构体留给下一次 addjob 使用
+ */
+int deljob(pid_t pid) {
+    struct job_t *job = getjobpid(pid);
+    return job != NULL ? deljobjid(job->jid) : 0;
+}
+
+/**
+ * deljobjid - 删除作业号为 jid 的作业，还没有进程的排队作业只能通过作业号删除
+ */
+int deljobjid(int jid) {
+    struct job_t *job = getjobjid(jid);
+    if (job == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < job->nproc; i++) {
+        if (job->procs[i].pid > 0) {
+            pid_remove(job->procs[i].pid);
+        }
+    }
+    if (job->nproc == 0) {
+        pid_remove(job->pid);
+    }
+    setjobstate(job, INVALID);
+    jidtab[job->jid] = NULL;
+    if (--count == 0) {     // 没有作业时 jid 重新从 1 开始
+        nextjid = 1;
+        nfree = 0;
+    } else {
+        freejids[nfree++] = job->jid;
+    }
+    if (job->arena) {   // 一次性释放解析树、命令行和 procs
+        arena_free(job->arena);
+    }
+    memset(job, 0, sizeof(struct job_t));
+    job->next = freejobs;
+    freejobs = job;
+    return 1;
+}
+
+/**
+ * maxjid - 返回当前最大的 jid，没有作业时返回 0
+ */
+int maxjid(void) {
+    int jid = nextjid - 1;
+    while (jid > 0 && jidtab[jid] == NULL) {
+        jid--;
+    }
+    return jid;
+}
+
+/**
+ * njobs - 返回作业的数量
+ */
+int njobs(void) {
+    return count;
+}
+
+/**
+ * setjobstate - 修改作业的状态，同时维护 BG 作业的计数和排队作业的链表，
+ * 作业的状态只能通过这里修改，这样判断能否启动排队的作业不需要遍历作业表
+ */
+void setjobstate(struct job_t *job, enum job_state state) {
+    if (job->state == state) {
+        return;
+    }
+    if (job->state == BG) {
+        nbg--;
+    } else if (job->state == QD) {  // 从链表中摘下
+        *(job->qprev ? &job->qprev->qnext : &qhead) = job->qnext;
+        *(job->qnext ? &job->qnext->qprev : &qtail) = job->qprev;
+        job->qprev = job->qnext = NULL;
+        nqd--;
+    }
+    if (state == BG) {
+        nbg++;
+    } else if (state == QD) {   // 加到链表末尾
+        job->qprev = qtail;
+        *(qtail ? &qtail->qnext : &qhead) = job;
+        qtail = job;
+        nqd++;
+    }
+    job->state = state;
+}
+
+/**
+ * njobs_bg - 返回 BG 状态的作业数
+ */
+int njobs_bg(void) {
+    return nbg;
+}
+
+/**
+ * njobs_queued - 返回 QD 状态的作业数
+ */
+int njobs_queued(void) {
+    return nqd;
+}
+
+/**
+ * firstqueued - 返回最早排队的作业，没有时返回 NULL
+ */
+struct job_t *firstqueued(void) {
+    return qhead;
+}
+
+/**
+ * getjobjid - 通过 jid 获得结构体
+ */
+struct job_t *getjobjid(int jid) {
+    if (jid <= 0 || jid >= nextjid) {
+        return NULL;
+    }
+    return jidtab[jid];
+}
+
+/**
+ * getjobpid - 通过 pid 获得结构体，pid 可以为进程组号，也可以为管道中任意一段的进程号
+ */
+struct job_t *getjobpid(pid_t pid) {
+    int i;
+    if (pid <= 0 || (i = pid_find(pid)) < 0) {
+        return NULL;
+    }
+    return pidtab[i].job;
+}
+
+/**
+ * getjobproc - 返回作业 job 中进程号为 pid 的进程
+ */
+struct proc_t *getjobproc(struct job_t *job, pid_t pid) {
+    int i = pid_find(pid);
+    if (i < 0 || pidtab[i].job != job) {
+        return NULL;
+    }
+    return pidtab[i].proc;
+}
+
+/**
+ * nextjob - 按 jid 从小到大遍历作业，*jid 初始为 0，
+ * 返回 jid 大于 *jid 的第一个作业并更新 *jid，没有时返回 NULL
+ */
+struct job_t *nextjob(int *jid) {
+    while (++*jid < nextjid) {
+        if (jidtab[*jid] != NULL) {
+            return jidtab[*jid];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * ts_diff - 返回 b - a，以秒为单位
+ */
+static double ts_diff(const struct timespec *a, const struct timespec *b) {
+    return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+static double tv_sec(const struct timeval *tv) {
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/**
+ * proc_usage - 计算进程 proc 的资源使用情况，尚未结束的进程只有运行时间
+ */
+void proc_usage(const struct proc_t *proc, struct usage *u) {
+    struct timespec now;
+    memset(u, 0, sizeof(struct usage));
+    if (proc->pid == 0) {   // 没有成功创建
+        return;
+    }
+    if (!proc->done) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    }
+    u->real = ts_diff(&proc->start, proc->done ? &proc->end : &now);
+    u->user = tv_sec(&proc->ru.ru_utime);
+    u->sys = tv_sec(&proc->ru.ru_stime);
+    u->maxrss = proc->ru.ru_maxrss;
+    u->nvcsw = proc->ru.ru_nvcsw;
+    u->nivcsw = proc->ru.ru_nivcsw;
+}
+
+/**
+ * job_usage - 计算作业 job 的资源使用情况，运行时间从第一个进程创建开始，
+ * 到最后一个进程结束为止，CPU 时间和上下文切换为各段之和
+ */
+void job_usage(const struct job_t *job, struct usage *u) {
+    struct usage pu;
+    const struct timespec *first = NULL;
+    memset(u, 0, sizeof(struct usage));
+    for (int i = 0; i < job->nproc; i++) {
+        const struct proc_t *proc = &job->procs[i];
+        if (proc->pid == 0) {
+            continue;
+        }
+        proc_usage(proc, &pu);
+        if (first == NULL || ts_diff(&proc->start, first) > 0) {
+            first = &proc->start;
+        }
+        u->user += pu.user;
+        u->sys += pu.sys;
+        u->nvcsw += pu.nvcsw;
+        u->nivcsw += pu.nivcsw;
+        if (pu.maxrss > u->maxrss) {
+            u->maxrss = pu.maxrss;
+        }
+    }
+    // 结束最晚的进程决定作业的运行时间
+    for (int i = 0; first != NULL && i < job->nproc; i++) {
+        const struct proc_t *proc = &job->procs[i];
+        if (proc->pid != 0) {
+            proc_usage(proc, &pu);
+            double real = pu.real + ts_diff(first, &proc->start);
+            if (real > u->real) {
+                u->real = real;
+            }
+        }
+    }
+}
+
+/**
+ * print_usage_header - 输出资源使用情况的表头，与 print_usage 的列对齐
+ */
+void print_usage_header(FILE *fp) {
+    fprintf(fp, "%10s %10s %10s %10s %7s %7s  %s\n",
+            "real", "user", "sys", "maxrss(KB)", "nvcsw", "nivcsw", "command");
+}
+
+/**
+ * print_usage - 输出一行资源使用情况，what 为对应的命令
+ */
+void print_usage(FILE *fp, const struct usage *u, const char *what) {
+    fprintf(fp, "%10.3f %10.3f %10.3f %10ld %7ld %7ld  %s\n",
+            u->real, u->user, u->sys, u->maxrss, u->nvcsw, u->nivcsw, what);
+}
+
+#define NDONE 16
+
+/**
+ * 最近结束的后台作业，作业结束时已经从作业表中删除，
+ * 这里保留它的资源使用情况，供 jobs -l 输出一次
+ */
+static struct done_job {
+    int jid;
+    pid_t pid;
+    char *cmdline;
+    struct usage u;
+} done_jobs[NDONE];
+static int ndone = 0;   // 记录的总数，超过 NDONE 时覆盖最早的记录
+
+/**
+ * save_done - 在删除结束的后台作业之前记录它的资源使用情况
+ */
+void save_done(const struct job_t *job) {
+    struct done_job *d = &done_jobs[ndone++ % NDONE];
+    free(d->cmdline);
+    d->jid = job->jid;
+    d->pid = job->pid;
+    d->cmdline = strdup(job->cmdline);
+    job_usage(job, &d->u);
+}
+
+/**
+ * list_done - 输出并清空最近结束的后台作业
+ */
+void list_done(FILE *fp) {
+    int first = ndone > NDONE ? ndone - NDONE : 0;
+    for (int i = first; i < ndone; i++) {
+        struct done_job *d = &done_jobs[i % NDONE];
+        fprintf(fp, "[%d] (%d) Done %s\n", d->jid, d->pid, d->cmdline);
+        print_usage(fp, &d->u, "(total)");
+    }
+    ndone = 0;
+}
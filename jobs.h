@@ -0,0 +1,98 @@
+#ifndef __JOBS_H_
+#define __JOBS_H_
+
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <time.h>
+
+struct cmd;
+struct arena;
+struct pqueue;
+
+/* 
+ * Jobs states: FG (foreground), BG (background), ST (stopped), QD (queued)
+ * Job state transitions and enabling actions:
+ *     FG -> ST  : ctrl-z
+ *     ST -> FG  : fg command
+ *     ST -> BG  : bg command
+ *     BG -> FG  : fg command
+ *     QD -> BG  : 运行中的后台作业少于 maxjobs，或者 bg command
+ *     QD -> FG  : fg command
+ * 最多一个作业能在 FG 状态，QD 状态的作业还没有创建任何进程
+ */
+/**
+ * 作业的状态
+ */
+enum job_state { INVALID, BG, FG, ST, QD };
+
+/**
+ * 作业中的一个进程，管道的每一段对应一个
+ */
+struct proc_t {
+    pid_t pid;      // 进程号，为 0 表示该段没有成功创建
+    int status;     // 退出状态，正常退出时为退出码，被信号终止时为 128 + 信号
+    int termsig;    // 终止进程的信号，正常退出时为 0
+    int done;       // 是否已经结束
+    const char *name;       // 命令名，从作业的内存池中分配
+    struct timespec start;  // 创建的时间（CLOCK_MONOTONIC）
+    struct timespec end;    // 被回收的时间
+    struct rusage ru;       // wait4 返回的资源使用情况，结束之前全部为 0
+};
+
+/**
+ * 作业或者其中一个进程的资源使用情况，时间以秒为单位
+ */
+struct usage {
+    double real;
+    double user;
+    double sys;
+    long maxrss;    // 最大的常驻内存（KB），作业取各段中的最大值
+    long nvcsw;     // 主动上下文切换的次数
+    long nivcsw;    // 被动上下文切换的次数
+};
+
+/**
+ * 表示作业的结构体
+ */
+struct job_t {
+    int jid;
+    pid_t pid;              // 进程组号，即管道中第一个进程的 pid
+    enum job_state state;
+    struct cmd *command;
+    struct arena *arena;    // 命令的内存池，解析树、命令行和 procs 都从中分配
+    int nproc;              // 管道的段数
+    int nlive;              // 尚未结束的进程数
+    struct proc_t *procs;   // 管道中每一段对应的进程
+    char *cmdline;          // 由于在解析中，我们会修改原始的命令，所以我们需要另一个副本
+    int timed;              // 由 time 运行，结束时输出资源使用情况
+    struct pqueue *queue;   // parallel 的任务所属的队列，其他作业为 NULL
+    int task;               // 在队列中的任务序号
+    struct job_t *qprev;    // QD 状态的作业按照排队的顺序组成的双向链表
+    struct job_t *qnext;
+    struct job_t *next;     // 空闲链表
+};
+
+struct job_t *addjob(char *cmdline, int bgfg, struct cmd *command, pid_t pid,
+                     struct proc_t *procs, int nproc, struct arena *arena);
+int deljob(pid_t pid);
+int deljobjid(int jid);
+void setjobpids(struct job_t *job, pid_t pid);
+void setjobstate(struct job_t *job, enum job_state state);
+int njobs_bg(void);
+int njobs_queued(void);
+struct job_t *firstqueued(void);
+int maxjid(void);
+int njobs(void);
+struct job_t *getjobjid(int jid);
+struct job_t *getjobpid(pid_t pid);
+struct proc_t *getjobproc(struct job_t *job, pid_t pid);
+struct job_t *nextjob(int *jid);
+void proc_usage(const struct proc_t *proc, struct usage *u);
+void job_usage(const struct job_t *job, struct usage *u);
+void print_usage_header(FILE *fp);
+void print_usage(FILE *fp, const struct usage *u, const char *what);
+void save_done(const struct job_t *job);
+void list_done(FILE *fp);
+
+#endif
@@ -0,0 +1,220 @@
+#include <string.h>
+
+#include "lexer.h"
+
+/**
+ * is_meta - 判断 ch 是否会结束一个单词
+ */
+static int is_meta(char ch) {
+    return ch == ' ' || ch == '\t' || ch == '|' || ch == '<' || ch == '>' || ch == '&' || ch == ';' ||
+           ch == '\0';
+}
+
+/**
+ * skip_brace - p 指向 ${ 中的 {，返回与之匹配的 } 的位置，其中的空格等不结束单词，
+ * 没有匹配的 } 时返回 NULL
+ */
+static const char *skip_brace(const char *p) {
+    int depth = 0;
+    for (; *p != '\0'; p++) {
+        if (*p == '\\' && p[1] != '\0') {
+            p++;
+        } else if (*p == '{') {
+            depth++;
+        } else if (*p == '}' && --depth == 0) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * skip_paren - p 指向 $( 中的 (，返回与之匹配的 ) 的位置，其中的空格、引号等不结束单词，
+ * 没有匹配的 ) 时返回 NULL
+ */
+static const char *skip_paren(const char *p) {
+    int depth = 0;
+    for (; *p != '\0'; p++) {
+        if (*p == '\\' && p[1] != '\0') {
+            p++;
+        } else if (*p == '\'' || *p == '"') {
+            const char *q = strchr(p + 1, *p);
+            if (q == NULL) {
+                return NULL;
+            }
+            p = q;
+        } else if (*p == '(') {
+            depth++;
+        } else if (*p == ')' && --depth == 0) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * skip_backquote - p 指向 `，返回与之匹配的 ` 的位置，其中的 \` 不结束命令替换，
+ * 没有匹配的 ` 时返回 NULL
+ */
+static const char *skip_backquote(const char *p) {
+    for (p++; *p != '\0'; p++) {
+        if (*p == '\\' && p[1] != '\0') {
+            p++;
+        } else if (*p == '`') {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * lex - 扫描一遍命令行 line，将记号存入从 a 中分配的数组 *toks，
+ * 最后一个记号为 TOK_END，返回记号的数量（不包括 TOK_END）。
+ * 单引号中的内容原样保留，双引号中可以使用反斜杠转义，引号外的反斜杠转义下一个字符。
+ * 含有 $ 或 ` 的单词（单引号中的除外）标记为 TOK_EXPAND，${...}、$(...) 和 `...` 中的内容属于同一个单词。
+ * 引号没有结束时返回 -1，并通过 err 返回错误信息
+ */
+int lex(struct arena *a, const char *line, struct token **toks, const char **err) {
+    size_t len = strlen(line);
+    // 每个记号至少占一个字符，因此 len + 1 个记号一定足够
+    struct token *t = (struct token *)arena_alloc(a, (len + 1) * sizeof(struct token));
+    const char *p = line;
+    int n = 0;
+
+    while (1) {
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        t[n].off = p - line;
+        t[n].flags = 0;
+        switch (*p) {
+            case '\0':
+                t[n].kind = TOK_END;
+                t[n].len = 0;
+                *toks = t;
+                return n;
+            case '|':
+                t[n].kind = TOK_PIPE;
+                p++;
+                break;
+            case '&':
+                t[n].kind = TOK_AMP;
+                p++;
+                break;
+            case ';':
+                t[n].kind = TOK_SEMI;
+                p++;
+                break;
+            case '<':
+                t[n].kind = TOK_LT;
+                p++;
+                break;
+            case '>':
+                if (p[1] == '>') {
+                    t[n].kind = TOK_GTGT;
+                    p += 2;
+                } else {
+                    t[n].kind = TOK_GT;
+                    p++;
+                }
+                break;
+            default:
+                t[n].kind = TOK_WORD;
+                while (!is_meta(*p)) {
+                    if (*p == '\\') {
+                        t[n].flags |= TOK_QUOTED;
+                        if (p[1] != '\0') {
+                            p++;
+                        }
+                    } else if (*p == '$') {
+                        t[n].flags |= TOK_EXPAND;
+                        if (p[1] == '{') {
+                            if ((p = skip_brace(p + 1)) == NULL) {
+                                *err = "${ 没有结束";
+                                return -1;
+                            }
+                        } else if (p[1] == '(' && (p = skip_paren(p + 1)) == NULL) {
+                            *err = "$( 没有结束";
+                            return -1;
+                        }
+                    } else if (*p == '`') {
+                        t[n].flags |= TOK_EXPAND;
+                        if ((p = skip_backquote(p)) == NULL) {
+                            *err = "` 没有结束";
+                            return -1;
+                        }
+                    } else if (*p == '\'' || *p == '"') {
+                        char quote = *p++;
+                        t[n].flags |= TOK_QUOTED;
+                        while (*p != quote) {
+                            if (*p == '\0') {
+                                *err = quote == '\'' ? "单引号没有结束" : "双引号没有结束";
+                                return -1;
+                            }
+                            if (quote == '"' && *p == '\\' && p[1] != '\0') {
+                                p++;
+                            } else if (quote == '"' && *p == '$') {
+                                t[n].flags |= TOK_EXPAND;
+                                if (p[1] == '(' && (p = skip_paren(p + 1)) == NULL) {
+                                    *err = "$( 没有结束";
+                                    return -1;
+                                }
+                            } else if (quote == '"' && *p == '`') {
+                                t[n].flags |= TOK_EXPAND;
+                                if ((p = skip_backquote(p)) == NULL) {
+                                    *err = "` 没有结束";
+                                    return -1;
+                                }
+                            }
+                            p++;
+                        }
+                    }
+                    p++;
+                }
+                break;
+        }
+        t[n].len = p - line - t[n].off;
+        n++;
+    }
+}
+
+/**
+ * lex_word - 返回单词记号 tok 的内容，去掉其中的引号和转义用的反斜杠，
+ * 结果从 a 中分配
+ */
+char *lex_word(struct arena *a, const char *line, const struct token *tok) {
+    const char *p = line + tok->off;
+    const char *end = p + tok->len;
+    if (!(tok->flags & TOK_QUOTED)) {
+        return arena_strndup(a, p, tok->len);
+    }
+    char *word = (char *)arena_alloc(a, tok->len + 1);
+    char *q = word;
+    while (p < end) {
+        if (*p == '\\') {
+            p++;
+            if (p < end) {
+                *q++ = *p++;
+            }
+        } else if (*p == '\'') {
+            while (*++p != '\'') {
+                *q++ = *p;
+            }
+            p++;
+        } else if (*p == '"') {
+            p++;
+            while (*p != '"') {
+                // 双引号中只有 \" \\ \$ \` 是转义
+                if (*p == '\\' && p[1] != '\0' && strchr("\"\\$`", p[1])) {
+                    p++;
+                }
+                *q++ = *p++;
+            }
+            p++;
+        } else {
+            *q++ = *p++;
+        }
+    }
+    *q = '\0';
+    return word;
+}
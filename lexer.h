@@ -0,0 +1,27 @@
+#ifndef __LEXER_H_
+#define __LEXER_H_
+
+#include "arena.h"
+
+/**
+ * 记号的种类
+ */
+enum tok_kind { TOK_WORD, TOK_PIPE, TOK_LT, TOK_GT, TOK_GTGT, TOK_AMP, TOK_SEMI, TOK_END };
+
+#define TOK_QUOTED 1    // 单词中含有引号或反斜杠，需要去掉引号
+#define TOK_EXPAND 2    // 单词中含有 $，运行时才能展开
+
+/**
+ * 一个记号，只记录在命令行中的位置，不复制内容
+ */
+struct token {
+    enum tok_kind kind;
+    int flags;
+    int off;    // 在命令行中的偏移
+    int len;    // 长度，单词包含其中的引号
+};
+
+int lex(struct arena *a, const char *line, struct token **toks, const char **err);
+char *lex_word(struct arena *a, const char *line, const struct token *tok);
+
+#endif
@@ -0,0 +1,53 @@
+/*
+ * mkbuiltins.c - 在编译时为 builtins.def 中的内部命令生成完美哈希表
+ *
+ * usage: mkbuiltins > builtin_hash.h
+ * 表的大小为不小于命令数两倍的 2 的幂，依次尝试种子，直到所有名字
+ * 哈希到不同的位置，输出种子和位置到命令下标的映射
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "built_in_command.h"
+
+#define BUILTIN(name, fn, flags) #name,
+static const char *names[] = {
+#include "builtins.def"
+};
+#undef BUILTIN
+
+#define NAMES ((int)(sizeof(names) / sizeof(names[0])))
+
+int main(void) {
+    int size = 1;
+    while (size < 2 * NAMES) {
+        size <<= 1;
+    }
+    signed char *slots = (signed char *)malloc(size);
+    for (unsigned int seed = 0; seed < 100000000u; seed++) {
+        int i;
+        memset(slots, -1, size);
+        for (i = 0; i < NAMES; i++) {
+            unsigned int h = builtin_hash(names[i], seed) & (size - 1);
+            if (slots[h] >= 0) {
+                break;
+            }
+            slots[h] = i;
+        }
+        if (i < NAMES) {
+            continue;
+        }
+        printf("/* 由 mkbuiltins 根据 builtins.def 生成，不要手动修改 */\n");
+        printf("#define BUILTIN_SEED %uu\n", seed);
+        printf("#define BUILTIN_SLOTS %d\n", size);
+        printf("static const signed char builtin_slots[BUILTIN_SLOTS] = {");
+        for (i = 0; i < size; i++) {
+            printf("%s%d", i == 0 ? "\n    " : i % 16 ? ", " : ",\n    ", slots[i]);
+        }
+        printf("\n};\n");
+        return 0;
+    }
+    fprintf(stderr, "mkbuiltins: 找不到合适的种子\n");
+    return 1;
+}
@@ -0,0 +1,251 @@
+/*
+ * myload.c - 可配置的负载程序，用于测试管道、重定向和作业控制的吞吐量
+ *
+ * usage: myload [-w bytes] [-r] [-b block] [-c ms] [-f n] [-s seed] [-e sum] [-q]
+ *   -w bytes  向标准输出写入 bytes 字节（可以带 K/M/G 后缀）
+ *   -r        从标准输入读到文件末尾
+ *   -b block  每次 read/write 的块大小，默认 64K
+ *   -c ms     消耗 ms 毫秒的 CPU 时间
+ *   -f n      创建 n 个子进程，每个子进程同样消耗 -c 指定的 CPU 时间，父进程等待它们结束
+ *   -s seed   写入数据的种子，默认为 1
+ *   -e sum    读入的数据的校验和不等于 sum 时以 1 退出
+ *   -q        不计算校验和，只测量吞吐量
+ * 写入的数据只由种子决定，与块大小无关，因此 myload -w N | myload -r 两端的校验和相同。
+ * 结束时向标准错误输出一行：
+ *   myload: wrote|read <bytes> bytes, checksum <sum>, <seconds> s, <MB/s> MB/s
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PATLEN 65536    // 数据以 PATLEN 字节为周期重复
+
+static size_t block = 65536;
+static int quiet = 0;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-w bytes] [-r] [-b block] [-c ms] [-f n] [-s seed] [-e sum] [-q]\n", name);
+    exit(1);
+}
+
+/* 解析带有 K/M/G 后缀的大小 */
+static unsigned long long parse_size(const char *s) {
+    char *end;
+    unsigned long long n = strtoull(s, &end, 0);
+    switch (*end) {
+        case 'k': case 'K':
+            return n << 10;
+        case 'm': case 'M':
+            return n << 20;
+        case 'g': case 'G':
+            return n << 30;
+    }
+    return n;
+}
+
+/**
+ * checksum - 对 buf[0, len) 更新 Fletcher 风格的 64 位校验和，结果只依赖于字节序列，
+ * 与数据被分成怎样的块无关
+ */
+static void checksum(const unsigned char *buf, size_t len, uint64_t *a, uint64_t *b) {
+    uint64_t x = *a, y = *b;
+    for (size_t i = 0; i < len; i++) {
+        x += buf[i];
+        y += x;
+    }
+    *a = x;
+    *b = y;
+}
+
+/**
+ * burn - 消耗 ms 毫秒的 CPU 时间（以进程的 CPU 时间计，而不是墙上时间）
+ */
+static void burn(long ms) {
+    struct timespec ts;
+    volatile uint64_t x = 0;
+    long long target, used;
+
+    if (ms <= 0) {
+        return;
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    target = ts.tv_sec * 1000000000LL + ts.tv_nsec + ms * 1000000LL;
+    do {
+        for (int i = 0; i < 100000; i++) {
+            x += i * x + 1;
+        }
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+        used = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    } while (used < target);
+}
+
+static void report(const char *what, unsigned long long bytes, uint64_t a, uint64_t b, double secs) {
+    if (quiet) {
+        fprintf(stderr, "myload: %s %llu bytes, %.3f s, %.1f MB/s\n", what, bytes, secs,
+                secs > 0 ? bytes / secs / 1e6 : 0);
+    } else {
+        fprintf(stderr, "myload: %s %llu bytes, checksum %016llx, %.3f s, %.1f MB/s\n", what, bytes,
+                (unsigned long long)(b << 32 ^ a), secs, secs > 0 ? bytes / secs / 1e6 : 0);
+    }
+}
+
+/**
+ * produce - 向标准输出写入 total 字节。buf 中是 block + PATLEN 字节的周期数据，
+ * 从 buf + off % PATLEN 开始写，就可以不复制数据地写出任意位置开始的一块
+ */
+static int produce(unsigned long long total, unsigned seed) {
+    unsigned char *buf = malloc(block + PATLEN);
+    unsigned long long off = 0;
+    uint64_t a = 0, b = 0;
+    uint32_t x = seed ? seed : 1;
+
+    if (buf == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    for (int i = 0; i < PATLEN; i++) {
+        // xorshift32
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        buf[i] = x;
+    }
+    for (size_t i = PATLEN; i < block + PATLEN; i++) {
+        buf[i] = buf[i % PATLEN];
+    }
+
+    double start = now();
+    while (off < total) {
+        size_t len = total - off < block ? total - off : block;
+        ssize_t n = write(1, buf + off % PATLEN, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("write");
+            free(buf);
+            return 1;
+        }
+        if (!quiet) {
+            checksum(buf + off % PATLEN, n, &a, &b);
+        }
+        off += n;
+    }
+    report("wrote", off, a, b, now() - start);
+    free(buf);
+    return 0;
+}
+
+/**
+ * consume - 从标准输入读到文件末尾，expect 不为 NULL 时检查校验和
+ */
+static int consume(const char *expect) {
+    unsigned char *buf = malloc(block);
+    unsigned long long total = 0;
+    uint64_t a = 0, b = 0;
+    ssize_t n;
+
+    if (buf == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    double start = now();
+    while ((n = read(0, buf, block)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("read");
+            free(buf);
+            return 1;
+        }
+        if (!quiet) {
+            checksum(buf, n, &a, &b);
+        }
+        total += n;
+    }
+    report("read", total, a, b, now() - start);
+    free(buf);
+    if (expect != NULL && strtoull(expect, NULL, 16) != (b << 32 ^ a)) {
+        fprintf(stderr, "myload: checksum mismatch, expected %s\n", expect);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    unsigned long long wbytes = 0;
+    int reading = 0, writing = 0, nchild = 0, opt, ret = 0;
+    long ms = 0;
+    unsigned seed = 1;
+    const char *expect = NULL;
+
+    while ((opt = getopt(argc, argv, "w:rb:c:f:s:e:q")) != -1) {
+        switch (opt) {
+            case 'w':
+                writing = 1;
+                wbytes = parse_size(optarg);
+                break;
+            case 'r':
+                reading = 1;
+                break;
+            case 'b':
+                block = parse_size(optarg);
+                break;
+            case 'c':
+                ms = atol(optarg);
+                break;
+            case 'f':
+                nchild = atoi(optarg);
+                break;
+            case 's':
+                seed = strtoul(optarg, NULL, 0);
+                break;
+            case 'e':
+                expect = optarg;
+                break;
+            case 'q':
+                quiet = 1;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind < argc || block == 0) {
+        usage(argv[0]);
+    }
+
+    for (int i = 0; i < nchild; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            break;
+        }
+        if (pid == 0) {
+            burn(ms);
+            exit(0);
+        }
+    }
+    if (reading) {
+        ret |= consume(expect);
+    }
+    burn(ms);
+    if (writing) {
+        ret |= produce(wbytes, seed);
+    }
+    while (wait(NULL) > 0) {
+        ;
+    }
+    exit(ret);
+}
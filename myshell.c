@@ -5,415 +5,589 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 #include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <poll.h>
 #include <signal.h>
 #include <unistd.h>
 #include <errno.h>
 
 #include "built_in_command.h"
+#include "spawn.h"
+#include "cmdhash.h"
+#include "reader.h"
+#include "arena.h"
+#include "lexer.h"
+#include "jobs.h"
+#include "stats.h"
+#include "trace.h"
+#include "cmd.h"
+#include "script.h"
+#include "var.h"
+#include "expand.h"
+#include "parallel.h"
 
 #define MAXLEN 128
-#define MAXARGS 16
-#define MAXJOBS 32
-#define FILELEN 16
+#define SUBST_CHUNK 65536   // 读入命令替换的输出时缓冲区的初始大小
 #define MODE (S_IRUSR | S_IWUSR | S_IXUSR | S_IROTH | S_IWOTH | S_IXOTH | S_IRGRP | S_IWGRP | S_IXGRP)
 
 mode_t mode; // 创建文件时的权限
 
-/**
- * 三种命令状态，EXEC 为正常运行，PIPE 为管道，REDIR 为重定向
- */
-enum cmd_type { EXEC, PIPE, REDIR };
-
-/**
- * 表示命令的结构体，模拟 C++ 的继承
- */
-struct cmd {
-    enum cmd_type type;
-    int fgbg;
-};
-
-/**
- * 直接运行的命令的结构体，type 一定为 EXEC
- */
-struct execcmd {
-    enum cmd_type type;
-    int fgbg;
-    int argc;
-    char *argv[MAXARGS];
-    char cmdline[MAXLEN];
-};
-
-/**
- * 管道命令的结构体，type 一定为 PIPE
- */
-struct pipecmd {
-    enum cmd_type type;
-    int fgbg;
-    struct cmd *left;
-    struct cmd *right;
-};
-
-/**
- * 管理重定向命令的结构体，type 一定为 REDIR
- */
-struct redircmd {
-    enum cmd_type type;
-    int fgbg;
-    struct cmd *command;
-    int mode;   // 追加或截断
-    char in_file[FILELEN];
-    char out_file[FILELEN];
-};
-
-/* 
- * Jobs states: FG (foreground), BG (background), ST (stopped)
- * Job state transitions and enabling actions:
- *     FG -> ST  : ctrl-z
- *     ST -> FG  : fg command
- *     ST -> BG  : bg command
- *     BG -> FG  : fg command
- * 最多一个作业能在 FG 状态
- */
-/**
- * 作业的状态
- */
-enum job_state { INVALID, BG, FG, ST };
-
-/**
- * 表示作业的结构体
- */
-struct job_t {
-    int jid;
-    pid_t pid;
-    enum job_state state;
-    struct cmd *command;
-    char cmdline[MAXLEN];   // 由于在解析中，我们会修改原始的命令，所以我们需要另一个字符数组
-} jobs[MAXJOBS];
-
-int nextjid = 1;    // 下一个要分配的 job id
-sig_atomic_t fgpid = 0; // 当我们从后台将一个作业移至前台，设置 fgpid, fgpid 为原子性变量
+pid_t fgpid = 0;    // 前台作业的进程组号，作业结束或者被停止时由 reap_children 清空
 char pwd[MAXLEN];   // 表示当前作业目录
+int pipefail = 0;   // set -o pipefail：管道的状态为最右边的非零状态
+int last_status = 0;        // 上一个前台作业的退出状态
+int *last_pipestatus = NULL;    // 上一个前台作业每一段的退出状态
+int last_npipe = 0;
+int loop_depth = 0;     // 正在运行的循环的层数
+int loop_break = 0;     // break n：还需要退出的循环层数
+int loop_continue = 0;  // continue n：还需要退出的循环层数加一，为 1 时继续当前的循环
+int interrupted = 0;    // 运行复合命令期间收到了 SIGINT，停止运行其余的命令
+int pipesize = 0;       // set -o pipesize[=N]：管道的容量（字节），0 表示使用系统的默认值
+int maxjobs = 0;        // set -o maxjobs=N：同时运行的后台作业数的上限，0 表示不限制
+pid_t shell_pid = 0;    // shell 自己的进程号，子进程继承的排队作业不能由子进程启动
+int builtin_bg = 0;     // 正在运行的内部命令是否以 & 运行，见 BI_ASYNC
+int subst_status = -1;  // 这条命令中最后一个命令替换的状态，-1 表示没有命令替换
 
-struct cmd *parseredir(char *buf, struct cmd *inner_command);
-struct cmd *parseexec(char *buf);
-struct cmd *parsepipe(char *buf);
-struct cmd *parsecmd(char *cmd);
 void eval(char *cmdline, struct cmd *command);
-int is_built_in_command(struct cmd *command);
-struct cmd *create_pipecmd(struct cmd *left, struct cmd *right);
-struct cmd *create_execcmd(char *buf);
-struct cmd *create_redircmd(struct cmd *inner_command, int mode, char *in_file, char *out_file);
+int run_builtin(struct cmd *command);
+int time_builtin(struct cmd *command);
+int redir_fd(const char *file, int flags, int target, int *saved);
+void redir_restore(int target, int saved);
+void run_exec(struct execcmd *exec_cmd);
 void execredir(struct redircmd *redir_cmd);
 struct execcmd *getexeccmd(struct cmd *command);
 void test_parse(struct cmd *command);
+void exec_external(char *argv[]);
+int is_spawnable(struct cmd *command);
+pid_t launch_cmd(struct cmd *command, int in_fd, int out_fd, pid_t pgid, const sigset_t *child_mask,
+                 int *status);
+int flatten_pipe(struct arena *a, struct cmd *command, struct cmd ***stages);
+void size_pipe(int fd);
+int launch_pipeline(char *cmdline, struct cmd **stages, int n, struct proc_t *procs,
+                    pid_t *pgid, const sigset_t *child_mask);
+int pipeline_status(struct proc_t *procs, int n);
+void save_status(struct proc_t *procs, int n);
+void run_job(char *cmdline, struct cmd *command, struct arena *arena, int timed);
+int start_job(struct job_t *job);
+void run_simple(char *cmdline, struct cmd *command, struct arena *arena, uint64_t start);
+const char *read_more(void *ctx);
+void set_status(int status);
+void run_tree(struct cmd *command);
+int exec_pipeline(char *cmdline, struct cmd *command, pid_t pgid);
 
 /*******************
  * 作业相关函数
 *******************/
-void initjob();
-struct job_t *addjob(char *cmdline, int bgfg, struct cmd *command, pid_t pid);
-void listjobs();
-int maxjid();
-int deljob(pid_t pid);
-struct job_t *getjobjid(int jid);
-struct job_t *getjobpid(pid_t pid);
+void listjobs(int verbose);
+void report_time(struct job_t *job);
+int shift_args(struct execcmd *exec_cmd, const char *word);
 
 /*******************
- * 信号相关函数
+ * 事件循环
 *******************/
-void sigchld_handler(int sig);
-void sigtstp_handler(int sig);
-void sigint_handler(int sig);
-typedef void handler_t(int);
-handler_t *Signal(int signum, handler_t *handler);
+sigset_t child_mask;    // shell 启动时的信号掩码，子进程恢复为这个掩码
+int sigfd = -1;         // 接收 SIGCHLD、SIGINT 和 SIGTSTP 的 signalfd
+int epfd = -1;          // 监听 sigfd 和交互模式下的标准输入
+int input_polled = 0;   // 标准输入是否加入了 epfd
+
+void event_init(int interactive);
+void handle_signals(void);
+void reap_children(void);
+void wait_input(struct reader *in);
+void drain_queued(void);
 
 /**
  * print_prompt - 输出提示符
  */
 void print_prompt() {
     printf("%s$ ", pwd);
+    fflush(stdout);     // 命令通过 read 读入，不会再自动刷新标准输出
 }
 
 /**
- * readcmd - 从标准输入读入命令，当遇到换行符时，停止读入
+ * readcmd - 从 in 中读入一行命令，行的长度没有限制，到达文件末尾时退出
  */
-void readcmd(char *cmd) {
-    char ch = '\0';
-    int len = 0;
-    while ((ch = getchar()) != '\n' && ch != EOF) {
-        cmd[len++] = ch;
-    }
-    if (len == 0 && ch == EOF) { // 到达文件末尾
+char *readcmd(struct reader *in) {
+    size_t len;
+    wait_input(in);
+    STATS_START(t);
+    char *cmd = reader_getline(in, &len);
+    STATS_END(PH_READ, t);
+    if (cmd == NULL) { // 到达文件末尾
+        drain_queued();
         exit(0);
     }
-    cmd[len] = '\0';
-}
-
-char whitespace[] = " \t";
-
-/**
- * next_nonempty - 寻找下一个非空白字符
- */
-char *next_nonempty(char *buf) {
-    while (*buf != '\0' && strchr(whitespace, *buf)) {
-        buf++;
-    }
-    return buf;
+    return cmd;
 }
 
 int main(int argc, char *argv[]) {
-    static char cmdline[MAXLEN];
-    // 通过 getenv 函数获得 PWD 环境变量
+    static struct reader in;
+    static struct script script;
+    struct script_cmd *sc;
+    struct cmd *command;
+    struct arena *arena;
+    char *cmdline;
+    uint64_t start;
+    // 环境变量导入 shell 的变量表，之后子进程的环境都由变量表构造
+    var_init(__environ);
     // PWD 的值为启动时的作业目录
-    strcpy(pwd, getenv("PWD"));
+    strcpy(pwd, var_get("PWD"));
     // 设置 shell 环境变量
-    setenv("SHELL", pwd, 1);
+    var_export("SHELL", pwd);
     mode = umask(0);  // 获得默认的设置
     umask(mode);      // 恢复默认设置
-    Signal(SIGCHLD, sigchld_handler);  // 设置子进程终止时调用的函数
-    Signal(SIGTSTP, sigtstp_handler);  // 设置子进程暂停时调用的函数, ctrl + z
-    Signal(SIGINT, sigint_handler);    // ctrl + c
-    initjob();
-    pid_t pid;
-    sigset_t oldmask, mask;
+    spawn_init();   // 选择创建进程的方式
+    shell_pid = getpid();
+    // 脚本模式下 $0 为脚本的路径，$1 开始为脚本的参数
+    var_setargs(argc > 1 ? argc - 1 : argc, argc > 1 ? argv + 1 : argv);
+    stats_init();
+    trace_init();
     int read_file = 0;  // 是否从文件中读入命令
-    int fd;             // 若从文件中读入命令，则 fd 保存打开的文件描述符
     if (argc >= 2) {    // 从命令行传入文件，即从命令行读入命令
         read_file = 1;
-        if ((fd = open(argv[1], O_RDONLY)) < 0) {   // 打开文件
+        // 运行之前先编译整个脚本，有语法错误时不运行任何命令，标准输入仍然留给运行的命令
+        int nerr = script_open(&script, argv[1]);
+        if (nerr < 0) {
             fprintf(stderr, "open %s error: %s\n", argv[1], strerror(errno));
             exit(1);
         }
-        // 打开文件成功，将其重定向到标准输入上
-        close(0);   // 关闭标准输入
-        dup(fd);    // 重定向
-        close(fd);
+        if (nerr > 0) {
+            exit(2);
+        }
+    } else {
+        reader_init(&in, 0);
     }
+    // 信号只通过 signalfd 在主循环中同步处理，不再使用信号处理函数
+    event_init(!read_file);
     while (1) {
-        if (!read_file) {   // 从标准输入读入
+        handle_signals();   // 回收已经结束的后台作业
+        if (read_file) {
+            if ((sc = script_next(&script)) == NULL) {
+                drain_queued();
+                exit(0);
+            }
+            start = trace_enabled ? stats_now() : 0;
+            cmdline = sc->cmdline;
+            command = sc->command;
+            // 命令树属于脚本，这条命令的内存池只用于作业的 procs 和命令行的副本
+            arena = arena_new(0);
+        } else {    // 从标准输入读入
             print_prompt();
+            cmdline = readcmd(&in);
+            // 解析树的所有结点都分配在这条命令的内存池中，
+            // 大小按照记号数组的上限估计，通常只需要一个块
+            size_t len = strlen(cmdline);
+            arena = arena_new((len + 1) * sizeof(struct token) + 2 * len);
+            start = trace_enabled ? stats_now() : 0;
+            STATS_START(t);
+            command = parsecmd(arena, cmdline, read_more, &in);
+            STATS_END(PH_PARSE, t);
+            if (trace_enabled) {
+                trace_span("parse", start, stats_now(), 0, 0, -1, NULL);
+            }
+            if (!command) { // 空命令
+                arena_free(arena);
+                continue;
+            }
         }
-        readcmd(cmdline);
-        struct cmd *command = parsecmd(cmdline);
-        if (!command) { // 空命令
+        if (command->type >= LIST) {    // 复合命令，每一条简单命令使用自己的内存池
+            interrupted = 0;
+            run_tree(command);
+            arena_free(arena);
             continue;
         }
-        if (!command->fgbg && (command->type == EXEC || strstr(cmdline, "exec")) &&
-            is_built_in_command(command) != 0) {
-                continue;   // 内部命令且为前台运行
-        }
-        // 阻塞 SIGCHLD 信号，防止子进程在父进程调用 addjob
-        // 之前就已经调用 deljob
-        sigfillset(&mask);
-        sigprocmask(SIG_BLOCK, &mask, &oldmask);
-        if ((pid = fork()) == 0) {
-            sigprocmask(SIG_SETMASK, &oldmask, NULL);
-            setpgid(0, 0);
-            eval(cmdline, command);
-        } else {
-            if (!command->fgbg) {
-                // 阻塞所有的信号，保护 jobs 数组
-                fgpid = pid;
-                addjob(cmdline, command->fgbg, command, pid);
-                sigprocmask(SIG_SETMASK, &oldmask, NULL);
-                waitfg();
-            }
-        }
+        run_simple(cmdline, command, arena, start);
     }
 
     return 0;
 }
 
 /**
- * create_pipecmd - 创建一个 pipecmd 对象
+ * async_builtin - 判断 command 是否为以 & 运行的、带有 BI_ASYNC 的内部命令，
+ * 这样的命令不放入子进程，在 shell 中运行，创建的作业才会出现在 shell 的作业表中
  */
-struct cmd *create_pipecmd(struct cmd *left, struct cmd *right) {
-    struct pipecmd *pipe_cmd = (struct pipecmd *)malloc(sizeof(struct pipecmd));
-    pipe_cmd->type = PIPE;
-    pipe_cmd->fgbg = 0;
-    pipe_cmd->type = PIPE;
-    pipe_cmd->left = left;
-    pipe_cmd->right = right;
-    return (struct cmd *)pipe_cmd;
+static int async_builtin(struct cmd *command) {
+    struct execcmd *exec_cmd = (struct execcmd *)command;
+    const struct builtin *bi;
+    if (!command->fgbg || command->type != EXEC || exec_cmd->argc == 0) {
+        return 0;
+    }
+    return (bi = builtin_lookup(exec_cmd->argv[0])) != NULL && (bi->flags & BI_ASYNC);
 }
 
 /**
- * create_execcmd - 创建一个 execcmd 对象
+ * run_simple - 运行一条简单命令，arena 为这一次运行的内存池，交给作业或者在返回前释放。
+ * start 为开始处理这条命令的时间，用于跟踪
  */
-struct cmd *create_execcmd(char *buf) {
-    struct execcmd *exec_cmd = (struct execcmd *)malloc(sizeof(struct execcmd));
-    exec_cmd->type = EXEC;
-    exec_cmd->fgbg = 0;
-    strcpy(exec_cmd->cmdline, buf);
-    return (struct cmd *)exec_cmd;
+void run_simple(char *cmdline, struct cmd *command, struct arena *arena, uint64_t start) {
+    // 展开参数中的变量，得到这一次运行的命令树，原来的命令树保持不变
+    subst_status = -1;
+    if ((command = expandcmd(arena, command)) == NULL) {   // 展开出错，不运行命令
+        set_status(1);
+        arena_free(arena);
+        return;
+    }
+    // time 后面的管道作为一个作业运行，结束时输出资源使用情况
+    int timed = shift_args(getexeccmd(command), "time");
+    builtin_bg = async_builtin(command);
+    if ((!command->fgbg || builtin_bg) && ((timed && time_builtin(command)) || run_builtin(command))) {
+        arena_free(arena);  // 内部命令且为前台运行
+    } else {
+        // 由 shell 直接创建管道中的每一个进程，不再先 fork 一个 shell 的副本，
+        // 后台作业也记录在 shell 的作业表中。内存池交给作业，作业被删除时释放
+        run_job(cmdline, command, arena, timed);
+    }
+    if (trace_enabled) {    // 前台命令到结束为止，后台命令到创建完所有进程为止
+        trace_span("command", start, stats_now(), 0, 0, command->fgbg ? -1 : last_status, cmdline);
+    }
 }
 
 /**
- * create_redircmd - 创建一个 redircmd 对象
+ * read_more - 复合命令没有结束时读入下一行，提示符为 "> "，到达文件末尾时返回 NULL
  */
-struct cmd *create_redircmd(struct cmd *inner_command, int mode, char *in_file, char *out_file) {
-    struct redircmd *redir_cmd = (struct redircmd *)malloc(sizeof(struct redircmd));
-    redir_cmd->type = REDIR;
-    redir_cmd->fgbg = 0;
-    redir_cmd->command = inner_command;
-    redir_cmd->mode = mode;
-    strcpy(redir_cmd->in_file, in_file);
-    strcpy(redir_cmd->out_file, out_file);
-    return (struct cmd *)redir_cmd;
+const char *read_more(void *ctx) {
+    struct reader *in = (struct reader *)ctx;
+    size_t len;
+    printf("> ");
+    fflush(stdout);
+    wait_input(in);
+    return reader_getline(in, &len);
 }
 
 /**
- * free_cmd - 释放 struct cmd 的资源
+ * set_status - 设置没有运行作业的命令的退出状态
  */
-void free_cmd(struct cmd *command) {
-    struct execcmd *exec_cmd;
-    struct pipecmd *pipe_cmd;
-    struct redircmd *redir_cmd;
-    // 判断 command 的类型
-    switch (command->type) {
-        case EXEC:
-            free(command);
-            break;
-        case PIPE:
-            pipe_cmd = (struct pipecmd *)command;
-            free_cmd(pipe_cmd->left);   // 释放左子结点的资源
-            free_cmd(pipe_cmd->right);  // 释放右子结点的资源
-            free(command);
-            break;
-        case REDIR:
-            redir_cmd = (struct redircmd *)command;
-            free_cmd(redir_cmd->command);  // 释放内部命令的资源
-            free(command);
-            break;
-    }
+void set_status(int status) {
+    struct proc_t proc = { 0, 1, 0, 1 };
+    proc.status = status;
+    save_status(&proc, 1);
 }
-/*
- * parsecmd - 解析输入的命令，将输入的命令按照空格
- * 进行分割，然后存储到 argv 数组中
- * 返回值：1——后台运行，0——前台运行
+
+/**
+ * loop_end - 循环每运行一次之后调用，处理 break 和 continue，返回非零表示退出这一层循环
  */
-struct cmd *parsecmd(char *cmd) {
-    if (*cmd == 0) {    // 空命令，返回 NULL
-        return NULL;
+int loop_end(void) {
+    if (loop_break > 0) {
+        loop_break--;
+        return 1;
     }
-    struct cmd *command = parsepipe(cmd);
-    if (strchr(cmd, '&') != NULL) { // 判断为前台运行还是后台运行
-        command->fgbg = 1;
+    if (loop_continue > 0) {    // continue n 在第 n 层循环继续，里面的循环都退出
+        return --loop_continue > 0;
     }
-    return command;
+    return interrupted;
 }
 
 /**
- * next_empty - 返回下一个字符为空字符或空格的位置
+ * run_while - 运行 while 循环，条件的状态为零时运行循环体。
+ * 状态为最后一次运行循环体的状态，循环体没有运行时为 0
  */
-char *next_empty(char *pos) {
-    while (*pos != '\0' && *pos != ' ') {
-        pos++;
+void run_while(struct whilecmd *while_cmd) {
+    int status = 0;
+    loop_depth++;
+    while (1) {
+        run_tree(while_cmd->cond);
+        if (loop_break || loop_continue || interrupted) {
+            if (loop_end()) {
+                break;
+            }
+            continue;
+        }
+        if (last_status != 0) {
+            break;
+        }
+        run_tree(while_cmd->body);
+        status = last_status;
+        if (loop_end()) {
+            break;
+        }
     }
-    return pos;
+    loop_depth--;
+    set_status(status);
 }
+
 /**
- * parseredir - 解析是否有重定向，如果有，则创建一个 redircmd 对象
+ * run_for - 运行 for 循环，单词只在开始时展开一次，之后依次赋给循环变量
  */
-struct cmd *parseredir(char *buf, struct cmd *inner_command) {
-    char *pos;
-    char in_file[FILELEN] = { '\0' };
-    char out_file[FILELEN] = { '\0' };
-    int mode = 0;
-    struct cmd *command = inner_command;
-    if ((pos = strchr(buf, '>')) != NULL) {
-        if (*(pos + 1) == '>') {    // 追加
-            mode = O_APPEND | O_CREAT | O_WRONLY;
-            pos++;
-        } else {   // 截断
-            mode = O_TRUNC | O_CREAT | O_WRONLY;
+void run_for(struct forcmd *for_cmd) {
+    struct arena *arena = arena_new(0);
+    struct execcmd *words = NULL;
+    int status = 0;
+    int n = var_nargs();
+
+    if (for_cmd->words != NULL) {
+        words = (struct execcmd *)expandcmd(arena, (struct cmd *)for_cmd->words);
+        if (words == NULL) {
+            arena_free(arena);
+            set_status(1);
+            return;
         }
-        // 复制输出文件名
-        pos = next_nonempty(pos + 1);
-        char *end_pos = next_empty(pos + 1);
-        strncpy(out_file, pos, end_pos - pos);
+        n = words->argc;
     }
+    loop_depth++;
+    for (int i = 0; i < n; i++) {
+        var_set(for_cmd->name, words ? words->argv[i] : var_arg(i + 1));
+        run_tree(for_cmd->body);
+        status = last_status;
+        if (loop_end()) {
+            break;
+        }
+    }
+    loop_depth--;
+    arena_free(arena);
+    set_status(status);
+}
 
-    if ((pos = strchr(buf, '<')) != NULL) {
-        // 复制输入文件名
-        pos = next_nonempty(pos + 1);
-        char *end_pos = next_empty(pos + 1);
-        strncpy(in_file, pos, end_pos - pos);
+/**
+ * run_tree - 运行复合命令。命令树在解析时只构造一次，循环的每一次都直接遍历它，
+ * 不再读入和解析。其中的简单命令与主循环中的命令一样运行，内部命令（如条件中的 test）
+ * 在 shell 进程中运行，不创建进程。执行 break、continue 或者收到 SIGINT 时提前返回
+ */
+void run_tree(struct cmd *command) {
+    switch (command->type) {
+        case LIST: {
+            struct listcmd *list = (struct listcmd *)command;
+            for (int i = 0; i < list->n && !loop_break && !loop_continue; i++) {
+                if (list->cmdlines[i] == NULL) {
+                    run_tree(list->cmds[i]);
+                    continue;
+                }
+                handle_signals();   // 回收已经结束的后台作业，检查 SIGINT
+                if (interrupted) {
+                    break;
+                }
+                run_simple(list->cmdlines[i], list->cmds[i], arena_new(0), trace_enabled ? stats_now() : 0);
+            }
+            break;
+        }
+        case IF: {
+            struct ifcmd *if_cmd = (struct ifcmd *)command;
+            run_tree(if_cmd->cond);
+            if (loop_break || loop_continue || interrupted) {
+                break;
+            }
+            if (last_status == 0) {
+                run_tree(if_cmd->then);
+            } else if (if_cmd->els != NULL) {
+                run_tree(if_cmd->els);
+            } else {
+                set_status(0);
+            }
+            break;
+        }
+        case WHILE:
+            run_while((struct whilecmd *)command);
+            break;
+        case FOR:
+            run_for((struct forcmd *)command);
+            break;
+        default:
+            fprintf(stderr, "unknown command type\n");
     }
+}
 
-    if (*in_file || *out_file) {    // 存在重定向
-        command = create_redircmd(inner_command, mode, in_file, out_file);
+/**
+ * loop_jump - break 和 continue 的公共部分，将 *count 设置为参数给出的循环层数
+ */
+int loop_jump(int argc, char *argv[], int *count) {
+    int n = argc > 1 ? atoi(argv[1]) : 1;
+    if (loop_depth == 0) {
+        fprintf(stderr, "%s: 只在循环中有意义\n", argv[0]);
+        return 0;
+    }
+    if (n < 1) {
+        fprintf(stderr, "%s: %s: 循环计数超出范围\n", argv[0], argv[1]);
+        return 1;
     }
+    *count = n < loop_depth ? n : loop_depth;
+    return 0;
+}
 
-    return command;
+/**
+ * break_imp - break 内部命令，退出 n 层循环，默认为 1
+ */
+int break_imp(int argc, char *argv[]) {
+    return loop_jump(argc, argv, &loop_break);
 }
 
 /**
- * parseecex - 解析命令，将命令行参数存储到结构体中
+ * continue_imp - continue 内部命令，继续第 n 层循环的下一次，默认为 1
  */
-struct cmd *parseexec(char *buf) {
-    int argc = 0;
-    int i = 0;
-    int begin = 0;
-    int len = strlen(buf);
-    int bg = 0;
-    struct cmd *command = create_execcmd(buf);
-    struct execcmd *ret = (struct execcmd *)command;
-    command = parseredir(buf, command);
-    char *array = ret->cmdline; // 指向结构体内部的命令
-    while (i < len) {
-        // 找到下一个非空字符，作为下一个参数的开始位置
-        while (array[begin] == ' ' || array[begin] == '\0') {
-            ++begin;
-        }
-        if (array[begin] == '>' || array[begin] == '<') {   // 如果遇到重定向符号，则直接跳过
-            if (array[begin + 1] == '>') {
-                begin++;
-            }
-            char *pos = next_nonempty(array + begin + 1);
-            char *end_pos = next_empty(pos + 1);
-            begin = i = end_pos - array;
+int continue_imp(int argc, char *argv[]) {
+    return loop_jump(argc, argv, &loop_continue);
+}
+
+/**
+ * subst_builtin - 在 shell 进程中运行命令替换中的内部命令，标准输出暂时换成
+ * 内存中可以增长的缓冲区，返回由 malloc 分配的输出，长度通过 *len 返回。
+ * 无法创建缓冲区时返回 NULL
+ */
+static char *subst_builtin(const struct builtin *bi, struct execcmd *exec_cmd, size_t *len, int *status) {
+    FILE *saved = stdout;
+    char *buf = NULL;
+
+    fflush(stdout);
+    if ((stdout = open_memstream(&buf, len)) == NULL) {
+        stdout = saved;
+        return NULL;
+    }
+    STATS_START(t);
+    *status = bi->fn(exec_cmd->argc, exec_cmd->argv);
+    STATS_END(PH_BUILTIN, t);
+    fclose(stdout);
+    stdout = saved;
+    return buf;
+}
+
+/**
+ * subst_read - 从管道 fd 读入命令替换的输出，直到所有的写端都关闭。缓冲区按两倍增长，
+ * 每次读入缓冲区剩余的全部空间。等待期间收到的 SIGINT 传递给进程组 pgid，
+ * pgid 为 0 时传递给进程 pid；子进程留给调用者回收，返回值非零表示读出了 SIGCHLD
+ */
+static int subst_read(int fd, pid_t pid, pid_t pgid, char **out, size_t *len) {
+    struct pollfd pfd[2] = { { fd, POLLIN, 0 }, { sigfd, POLLIN, 0 } };
+    struct signalfd_siginfo info[16];
+    size_t cap = SUBST_CHUNK;
+    char *buf = (char *)malloc(cap);
+    size_t n = 0;
+    int chld = 0;
+    ssize_t r;
+
+    while (1) {
+        if (poll(pfd, 2, -1) < 0) {
             continue;
         }
-        // 找到下一个空字符，作为当前参数的结束位置，然后将
-        // 该位置的字符设置为 '\0'
-        i = begin + 1;
-        while (array[i] != ' ' && array[i] != '\0') {
-            ++i;
+        if (pfd[1].revents & POLLIN) {
+            while ((r = read(sigfd, info, sizeof(info))) > 0) {
+                for (int i = 0; i < r / (ssize_t)sizeof(info[0]); i++) {
+                    if (info[i].ssi_signo == SIGCHLD) {
+                        chld = 1;
+                    } else if (info[i].ssi_signo == SIGINT) {
+                        interrupted = 1;
+                        kill(pgid ? -pgid : pid, SIGINT);
+                    }
+                }
+            }
         }
-        array[i] = '\0';
-        if (strcmp(&array[begin], "&") == 0) {
-            // 我们只假设 & 为命令的最后一个参数，所以当我们遇到 & 时，
-            // 我们直接退出，尽管后面还可能有其他的参数
-            break;
+        if (pfd[0].revents) {
+            if (cap - n < SUBST_CHUNK / 2) {
+                cap *= 2;
+                buf = (char *)realloc(buf, cap);
+            }
+            if ((r = read(fd, buf + n, cap - n)) > 0) {
+                n += r;
+            } else if (r == 0 || errno != EINTR) {
+                break;
+            }
         }
-        ret->argv[argc++] = &array[begin];
-        begin = ++i;
     }
-    ret->argv[argc] = NULL;
-    ret->argc = argc;
-    return command;
+    *out = buf;
+    *len = n;
+    return chld;
 }
 
 /**
- * parsepipe - 解析是否为管道，如果发现 |，
- * 则说明有管道，如果没有，则调用 parseexec 解析命令
+ * cmdsubst - 运行命令替换 $(...) 或 `...` 中的命令 text，返回由 malloc 分配的输出，
+ * 长度通过 *outlen 返回，命令的状态保存在 subst_status 中。
+ * 不修改 shell 状态的内部命令（如 echo、pwd）在 shell 中运行，输出写入内存，不创建进程；
+ * 外部命令和管道与 run_job 一样由 shell 直接创建，最后一段的输出通过管道读入；
+ * 复合命令和必须在 shell 中运行的内部命令（如 cd）在 fork 出的子 shell 中运行，不影响 shell
  */
-struct cmd *parsepipe(char *buf) {
-    struct cmd *command = NULL;
-    char *pos = strchr(buf, '|');
+char *cmdsubst(const char *text, size_t len, size_t *outlen) {
+    struct arena *arena = arena_new(0);
+    char *line = arena_strndup(arena, text != NULL ? text : "", len);
+    const char *err = NULL;
+    struct cmd *command = parseline(arena, arena, line, NULL, NULL, &err);
+    struct execcmd *exec_cmd;
+    const struct builtin *bi;
+    uint64_t start = trace_enabled ? stats_now() : 0;
+    char *out = NULL;
+    int status = 0, chld = 0;
+    pid_t pid = 0, pgid = 0;
+    int fds[2];
 
-    if (pos != NULL) { // 找到 '|'，为管道
-        *pos = '\0';
-        char *next = next_nonempty(pos + 1);
-        command = parseexec(buf);
-        command = create_pipecmd(command, parsecmd(next));
-        *pos = '|';  // 为了能够输出整条命令，我们将之前清空的 | 恢复
+    *outlen = 0;
+    if (command == NULL) {  // 空命令或者语法错误
+        if (err != NULL) {
+            fprintf(stderr, "myshell: 语法错误: %s\n", err);
+            status = 2;
+        }
+        goto done;
+    }
+    if (command->type < LIST) {
+        if ((command = expandcmd(arena, command)) == NULL) {
+            status = 1;
+            goto done;
+        }
+        exec_cmd = getexeccmd(command);
+        if (command->type == EXEC && exec_cmd->argc > 0 && exec_cmd->nassign == 0 &&
+            (bi = builtin_lookup(exec_cmd->argv[0])) != NULL && !(bi->flags & (BI_PARENT | BI_RAWFD)) &&
+            (out = subst_builtin(bi, exec_cmd, outlen, &status)) != NULL) {
+            goto done;
+        }
+    }
+    fflush(stdout);     // 缓冲区中的内容不能进入管道或者子进程
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        fprintf(stderr, "pipe error: %s\n", strerror(errno));
+        status = 1;
+        goto done;
+    }
+    size_pipe(fds[1]);
+    if (command->type < LIST) {
+        struct cmd **stages;
+        int n = flatten_pipe(arena, command, &stages);
+        struct proc_t *procs = (struct proc_t *)arena_alloc(arena, n * sizeof(struct proc_t));
+        // 创建期间标准输出换成管道的写端，管道的每一段都由 launch_pipeline 直接创建
+        int saved = fcntl(1, F_DUPFD_CLOEXEC, 10);
+        dup2(fds[1], 1);
+        close(fds[1]);
+        launch_pipeline(line, stages, n, procs, &pgid, &child_mask);
+        redir_restore(1, saved);
+        chld = subst_read(fds[0], 0, pgid, &out, outlen);
+        for (int i = 0; i < n; i++) {
+            if (procs[i].pid > 0 && waitpid(procs[i].pid, &status, 0) > 0) {
+                procs[i].status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+            }
+        }
+        status = pipeline_status(procs, n);
     } else {
-        command = parseexec(buf);
+        if ((pid = fork()) == 0) {  // 子 shell，其中的修改不影响原来的 shell
+            close(fds[0]);
+            dup2(fds[1], 1);
+            close(fds[1]);
+            loop_depth = 0;
+            interrupted = 0;
+            run_tree(command);
+            fflush(stdout);
+            _exit(last_status);
+        }
+        close(fds[1]);
+        if (pid < 0) {
+            fprintf(stderr, "fork error: %s\n", strerror(errno));
+            close(fds[0]);
+            status = 1;
+            goto done;
+        }
+        chld = subst_read(fds[0], pid, 0, &out, outlen);
+        if (waitpid(pid, &status, 0) > 0) {
+            status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        }
     }
-    return command;
+    close(fds[0]);
+    if (chld) {     // 替换期间结束的后台作业
+        reap_children();
+    }
+
+done:
+    if (trace_enabled) {
+        trace_span("subst", start, stats_now(), pid, pgid, status, line);
+    }
+    subst_status = status;
+    arena_free(arena);
+    return out != NULL ? out : (char *)calloc(1, 1);
 }
 
 /**
@@ -421,99 +595,31 @@ struct cmd *parsepipe(char *buf) {
  */
 void execredir(struct redircmd *redir_cmd) {
     int fd;
-    struct execcmd *exec_cmd;
-    int built_in;
-    if (*redir_cmd->in_file) {  // 重定向标准输入
+    if (redir_cmd->in_file) {   // 重定向标准输入
         close(0);
         if ((fd = open(redir_cmd->in_file, O_RDONLY)) != 0) {
             fprintf(stderr, "open error: %s\n", strerror(errno));
         }
     }
-    if (*redir_cmd->out_file) { // 重定向标准输出
+    if (redir_cmd->out_file) {  // 重定向标准输出
         close(1);                   
         if ((fd = open(redir_cmd->out_file, redir_cmd->mode, MODE ^ mode)) != 1) {
             fprintf(stderr, "open error: %s\n", strerror(errno));
         }
     }
-    exec_cmd = (struct execcmd *)redir_cmd->command;
-    built_in = is_built_in_command(redir_cmd->command); // 判断是否是内部命令
-    if (!built_in) {
-        execve(exec_cmd->argv[0], exec_cmd->argv, __environ);
-        fprintf(stderr, "%s: 未找到命令\n", exec_cmd->argv[0]);
-        exit(1);
-    } else {
-        exit(0);
-    }
+    run_exec((struct execcmd *)redir_cmd->command);
 }
 
 /**
  * eval - 根据传入的 command 的类型选择运行的方式
  */
 void eval(char *cmdline, struct cmd *command) {
-    struct execcmd *exec_cmd;
-    struct pipecmd *pipe_cmd;
-    int built_in;
-    int fd;
-    int fds[2];
-    pid_t pid = 0;
-
-    if (command->fgbg) {  // 后台运行，直接创建一个进程运行
-        sigset_t mask, oldmask;
-        sigfillset(&mask);
-        sigprocmask(SIG_BLOCK, &mask, &oldmask);
-        if ((pid = fork()) == 0) {
-            sigprocmask(SIG_SETMASK, &oldmask, NULL);
-            command->fgbg = 0;
-            setpgid(0, 0);
-            eval(cmdline, command);
-        } else {
-            // 阻塞所有的信号，保护 jobs 数组
-            struct job_t *job = addjob(cmdline, command->fgbg, command, pid);
-            printf("[%d] (%d) %s\n", job->jid, job->pid, job->cmdline);
-            sigprocmask(SIG_SETMASK, &oldmask, NULL);
-            exit(0);
-        }
-    }
-
     switch (command->type) {
         case EXEC:  // 直接运行
-            exec_cmd = (struct execcmd *)command;
-            built_in = is_built_in_command(command); // 判断是否是内部命令
-            if (!built_in) {    // 不为内置命令
-                execve(exec_cmd->argv[0], exec_cmd->argv, __environ);
-                fprintf(stderr, "%s: 未找到命令\n", cmdline);
-                exit(1);
-            } else {    // 内部命令，直接退出
-                exit(0);
-            }
+            run_exec((struct execcmd *)command);
             break;
-        case PIPE:  // 管道
-            pipe_cmd = (struct pipecmd *)command;
-            if (pipe(fds) == -1) {
-                fprintf(stderr, "pipe error: %s\n", strerror(errno));
-            }
-
-            if (fork() == 0) {  //  right
-                close(0);
-                dup(fds[0]);    // 将管道复制到标准输入上
-                close(fds[0]);
-                close(fds[1]);
-                eval(cmdline, pipe_cmd->right);
-            }
-
-            if (fork() == 0) {    //  left
-                close(1);
-                dup(fds[1]);      // 将管道复制到标准输出上
-                close(fds[0]);
-                close(fds[1]);
-                eval(cmdline, pipe_cmd->left);
-            }
-            close(fds[0]);
-            close(fds[1]);
-            // 等待两个子进程完成运行
-            wait(0);
-            wait(0);
-            exit(0);
+        case PIPE:  // 管道，所有的段都由当前进程创建，并加入当前进程组
+            exit(exec_pipeline(cmdline, command, getpgrp()));
             break;
         case REDIR:
             execredir((struct redircmd *)command);
@@ -548,255 +654,672 @@ struct execcmd *getexeccmd(struct cmd *command) {
 }
 
 /**
- * is_buiit_in_command - 判断是否为内部命令，若是内部命令，
- * 则运行内部命令，并返回非零值；否则，返回 0，表示当前命令不为
- * 内部命令
- */
-int is_built_in_command(struct cmd *command) {
-    struct execcmd *exec_cmd = getexeccmd(command);
-    
-    if (strcmp(exec_cmd->argv[0], "bg") == 0) {
-        bg_imp(exec_cmd->argc, exec_cmd->argv);
-        return 1;
-    } else if (strcmp(exec_cmd->argv[0], "cd") == 0) {
-        cd_imp(exec_cmd->argv[1]);
-        return 2;
-    } else if (strcmp(exec_cmd->argv[0], "clr") == 0) {
-        clr_imp();
-        return 3;
-    } else if (strcmp(exec_cmd->argv[0], "dir") == 0) {
-        dir_imp(exec_cmd->argv[1]);
-        return 4;
-    } else if (strcmp(exec_cmd->argv[0], "echo") == 0) {
-        echo_imp(exec_cmd->argv);
-        return 5;
-    } else if (strcmp(exec_cmd->argv[0], "exec") == 0) {
-        exec_imp(command);
-        exit(0);
-    } else if (strcmp(exec_cmd->argv[0], "exit") == 0) {
-        exit(0);
-    } else if (strcmp(exec_cmd->argv[0], "fg") == 0) {
-        int ret = fg_imp(exec_cmd->argc, exec_cmd->argv);
-        if (!ret) {
-            waitfg();
-        }
-        return 8;
-    } else if (strcmp(exec_cmd->argv[0], "help") == 0) {
-        help_imp();
-        return 9;
-    } else if (strcmp(exec_cmd->argv[0], "jobs") == 0) {
-        listjobs();
-        return 10;
-    } else if (strcmp(exec_cmd->argv[0], "pwd") == 0) {
-        printf("%s\n", pwd);
-        return 11;
-    } else if (strcmp(exec_cmd->argv[0], "set") == 0) {
-        set_imp();
-        return 12;
-    } else if (strcmp(exec_cmd->argv[0], "test") == 0) {
-        test_imp(exec_cmd->argc, exec_cmd->argv);
-        return 13;
-    } else if (strcmp(exec_cmd->argv[0], "time") == 0) {
-        time_imp();
-        return 14;
-    } else if (strcmp(exec_cmd->argv[0], "umask") == 0) {
-        umask_imp(exec_cmd->argv);
-        return 15;
-    }
-    return 0;
-}
-
-/**
- * exec_imp - exec 内部命令的实现
+ * is_spawnable - 判断 command 是否可以由 spawn_exec 直接运行，
+ * 即为外部命令，或者带有重定向的外部命令
  */
-void exec_imp(struct cmd *command) {
+int is_spawnable(struct cmd *command) {
     struct execcmd *exec_cmd;
-    struct pipecmd *pipe_cmd;
-    int i, built_in;
-    int fd[2];
-
-    switch (command->type) {
-        case EXEC:  // 直接执行
-            exec_cmd = (struct execcmd *)command;
-            if (strcmp(exec_cmd->argv[0], "exec") == 0) {   // 若为 exec 命令，则需要将命令行参数向前移动一位
-                for (i = 0; i < exec_cmd->argc; i++) {
-                    exec_cmd->argv[i] = exec_cmd->argv[i + 1];
-                }
-            }
-            int built_in = is_built_in_command(command);
-
-            if (!built_in) {
-                execve(exec_cmd->argv[0], exec_cmd->argv, __environ);
-                fprintf(stderr, "%s: 未找到命令\n", exec_cmd->argv[0]);
-                exit(1);
-            }
-            exit(0);
-            break;
-        case PIPE:  // 管道
-            pipe_cmd = (struct pipecmd *)command;
-            if (pipe(fd) == -1) {
-                fprintf(stderr, "pipe error: %s\n", strerror(errno));
-            }
-
-            if (fork() == 0) {  //  right
-                close(0);
-                dup(fd[0]);     // 将管道复制到标准输入上
-                close(fd[0]);
-                close(fd[1]);
-                exec_imp(pipe_cmd->right);
-            }
-
-            if (fork() == 0) {    //  left
-                close(1);
-                dup(fd[1]);       // 将管道复制到标准输出上
-                close(fd[0]);
-                close(fd[1]);
-                exec_imp(pipe_cmd->left);
-            }
-            close(fd[0]);
-            close(fd[1]);
-            // 等待两个子进程完成运行
-            wait(0);
-            wait(0);
-            exit(0);
-            break;
-        case REDIR: // 重定向
-            execredir((struct redircmd *)command);
-            break;
+    if (command->type == REDIR) {
+        command = ((struct redircmd *)command)->command;
     }
-}
-
-/**
- * test_parse - 测试解析的结果
- */
-void test_parse(struct cmd *command) {
-    struct execcmd *exec_cmd;
-    struct pipecmd *pipe_cmd;
-    struct redircmd *redir_cmd;
-    printf("%s\n", command->fgbg ? "bg" : "fg");
-    switch (command->type) {
-        case EXEC:
-            exec_cmd = (struct execcmd *)command;
-            printf("exec:\n");
-            char *str = exec_cmd->argv[0];
-            for (int i = 0; str; i++, str = exec_cmd->argv[i]) {
-                printf("%s\n", str);
-            }
-            break;
-        case PIPE:
-            pipe_cmd = (struct pipecmd *)command;
-            printf("pipe:\n");
-            printf("left:\n");
-            test_parse(pipe_cmd->left);
-            printf("right:\n");
-            test_parse(pipe_cmd->right);
-            break;
-        case REDIR:
-            redir_cmd = (struct redircmd *)command;
-            printf("redir:\n");
-            printf("in_file: %s\n", redir_cmd->in_file);
-            printf("out_file: %s\n", redir_cmd->out_file);
-            break;
+    if (command->type != EXEC) {
+        return 0;
     }
+    exec_cmd = (struct execcmd *)command;
+    return exec_cmd->argv[0] != NULL && builtin_lookup(exec_cmd->argv[0]) == NULL;
 }
 
 /**
- * clearjob - 清空 job_t 结构体
+ * redir_open - 打开重定向的文件，file 为 NULL 或空串时返回 -2 表示没有重定向，
+ * 打开失败时输出 <file>: 错误信息并返回 -1
  */
-void clearjob(struct job_t *job) {
-    *(job->cmdline) = '\0';
-    if (job->command) {  // 释放 command 资源
-        free_cmd(job->command);
+static int redir_open(const char *file, int flags) {
+    int fd;
+    if (file == NULL || *file == '\0') {
+        return -2;
     }
-    job->command = NULL;
-    job->jid = 0;
-    job->pid = 0;
-    job->state = INVALID;
-}
-
-/**
- * initjob - 初始化 job_t 数组
- */
-void initjob() {
-    for (int i = 0; i < MAXJOBS; i++) {
-        clearjob(&jobs[i]);
+    if ((fd = open(file, flags | O_CLOEXEC, MODE ^ mode)) < 0) {
+        fprintf(stderr, "%s: %s\n", file, strerror(errno));
     }
+    return fd;
 }
 
 /**
- * addjob - 向 job_t 数组中添加一个 job，返回刚设置的结构体
+ * launch_cmd - 通过 spawn_exec 运行一个外部命令，in_fd 和 out_fd 为
+ * 管道的描述符（-1 表示不使用）。重定向的文件在创建进程之前由 shell 打开，
+ * 代替管道的描述符交给 spawn 层，这样 spawn_exec 的错误只可能来自 execve。
+ * 返回子进程的 pid，失败时输出错误信息，将退出状态写入 *status 并返回 -1
  */
-struct job_t *addjob(char *cmdline, int bgfg, struct cmd *command, pid_t pid) {
-    for (int i = 0; i < MAXJOBS; i++) {
-        if (jobs[i].state == INVALID) {
-            jobs[i].state = bgfg ? BG : FG;
-            jobs[i].pid = pid;
-            jobs[i].command = command;
-            strcpy(jobs[i].cmdline, cmdline);
-            jobs[i].jid = nextjid++;
-            if (nextjid > MAXJOBS) {
-                nextjid = 1;
+pid_t launch_cmd(struct cmd *command, int in_fd, int out_fd, pid_t pgid, const sigset_t *child_mask,
+                 int *status) {
+    struct spawn_io io = { in_fd, out_fd, NULL, NULL, 0, MODE ^ mode };
+    struct execcmd *exec_cmd = getexeccmd(command);
+    struct redircmd *redir_cmd;
+    char **envp = var_environ();    // 没有修改导出的变量时直接使用缓存的环境
+    int redir_in = -2, redir_out = -2;
+    pid_t pid;
+
+    if (command->type == REDIR) {
+        redir_cmd = (struct redircmd *)command;
+        if ((redir_in = redir_open(redir_cmd->in_file, O_RDONLY)) == -1 ||
+            (redir_out = redir_open(redir_cmd->out_file, redir_cmd->mode)) == -1) {
+            if (redir_in >= 0) {
+                close(redir_in);
             }
-            return &jobs[i];
+            *status = 1;
+            return -1;
+        }
+        if (redir_in >= 0) {    // 重定向优先于管道
+            io.in_fd = redir_in;
+        }
+        if (redir_out >= 0) {
+            io.out_fd = redir_out;
         }
     }
-    fprintf(stderr, "作业数量过多\n");
-    return NULL;
+    *status = 127;
+    const char *path = cmdhash_lookup(exec_cmd->argv[0]);
+    if (path == NULL) {     // PATH 中没有该命令，不需要调用 execve
+        fprintf(stderr, "%s: 未找到命令\n", exec_cmd->argv[0]);
+        pid = -1;
+        goto out;
+    }
+    if (exec_cmd->nassign) {    // name=value cmd，赋值只加入这个命令的环境
+        envp = var_environ_with(exec_cmd->assign, exec_cmd->nassign);
+    }
+    pid = spawn_exec(path, exec_cmd->argv, envp, &io, pgid, child_mask);
+    if (pid < 0 && errno == ENOENT && path != exec_cmd->argv[0]) {
+        // 缓存的路径已经不存在，重新在 PATH 中查找一次
+        cmdhash_forget(exec_cmd->argv[0]);
+        if ((path = cmdhash_lookup(exec_cmd->argv[0])) != NULL) {
+            pid = spawn_exec(path, exec_cmd->argv, envp, &io, pgid, child_mask);
+        }
+    }
+    if (exec_cmd->nassign) {
+        free(envp);
+    }
+    if (pid < 0) {
+        if (path == NULL || errno == ENOENT) {
+            fprintf(stderr, "%s: 未找到命令\n", exec_cmd->argv[0]);
+        } else {
+            fprintf(stderr, "%s: %s\n", exec_cmd->argv[0], strerror(errno));
+        }
+    }
+out:
+    if (redir_in >= 0) {
+        close(redir_in);
+    }
+    if (redir_out >= 0) {
+        close(redir_out);
+    }
+    return pid;
 }
 
 /**
- * maxjid - 返回当前最大的 jid
+ * run_exec - 在当前进程中运行 exec_cmd，内部命令运行后以其状态退出，
+ * 外部命令替换当前进程，不返回
  */
-int maxjid() {
-    int jid = 0;
-    for (int i = 0; i < MAXJOBS; i++) {
-        if (jobs[i].state != INVALID && jobs[i].jid > jid) {
-            jid = jobs[i].jid;
+void run_exec(struct execcmd *exec_cmd) {
+    if (exec_cmd->argc == 0) {  // 子进程中的赋值不影响 shell
+        exit(0);
+    }
+    for (int i = 0; i < exec_cmd->nassign; i++) {   // name=value cmd，导出给这个命令
+        var_assign(exec_cmd->assign[i], 1);
+    }
+    const struct builtin *bi = builtin_lookup(exec_cmd->argv[0]);
+    if (bi != NULL) {
+        exit(bi->fn(exec_cmd->argc, exec_cmd->argv));
+    }
+    exec_external(exec_cmd->argv);
+}
+
+/**
+ * exec_external - 在 PATH 中查找 argv[0] 并用 execve 替换当前进程，失败时退出
+ */
+void exec_external(char *argv[]) {
+    const char *path = cmdhash_lookup(argv[0]);
+    if (path != NULL) {
+        execve(path, argv, var_environ());
+    }
+    fprintf(stderr, "%s: 未找到命令\n", argv[0]);
+    exit(127);
+}
+
+/**
+ * flatten_pipe - 将右递归的 pipecmd 树展开为数组，*stages 指向从 a 中分配的数组，
+ * 每一个元素为 EXEC 或 REDIR 类型的命令，返回管道的段数
+ */
+int flatten_pipe(struct arena *a, struct cmd *command, struct cmd ***stages) {
+    struct cmd *cur;
+    int n = 1;
+    for (cur = command; cur->type == PIPE; cur = ((struct pipecmd *)cur)->right) {
+        n++;
+    }
+    *stages = (struct cmd **)arena_alloc(a, n * sizeof(struct cmd *));
+    n = 0;
+    for (cur = command; cur->type == PIPE; cur = ((struct pipecmd *)cur)->right) {
+        (*stages)[n++] = ((struct pipecmd *)cur)->left;
+    }
+    (*stages)[n++] = cur;
+    for (int i = 0; i < n; i++) {   // 后台标志只属于整个作业
+        (*stages)[i]->fgbg = 0;
+    }
+    return n;
+}
+
+/**
+ * size_pipe - 设置了 pipesize 时调整管道的容量，失败时（如超出用户的配额）保持默认的容量
+ */
+void size_pipe(int fd) {
+    if (pipesize > 0) {
+        fcntl(fd, F_SETPIPE_SZ, pipesize);
+    }
+}
+
+/**
+ * launch_pipeline - 在当前进程中创建管道的所有段，所有的进程都加入进程组 *pgid，
+ * *pgid 为 0 时以第一个进程为组长创建新的进程组，并通过 *pgid 返回。
+ * 外部命令通过 spawn_exec 创建，内部命令需要 fork 后在子进程中运行。
+ * procs 中记录每一段的进程号，创建失败的段直接记为结束，状态为 127。
+ * child_mask 为子进程的信号掩码，返回成功创建的进程数
+ */
+int launch_pipeline(char *cmdline, struct cmd **stages, int n, struct proc_t *procs,
+                    pid_t *pgid, const sigset_t *child_mask) {
+    int in_fd = -1;     // 当前段的输入，即上一个管道的读端
+    int fds[2];
+    int nlive = 0;
+    int status;
+    const struct builtin *bi;
+    pid_t pid;
+
+    STATS_START(launch);
+    fflush(stdout);     // 内部命令的输出必须在子进程的输出之前
+    for (int i = 0; i < n; i++) {
+        uint64_t start = trace_enabled ? stats_now() : 0;
+        STATS_START(t);
+        fds[0] = fds[1] = -1;
+        // 管道带有 O_CLOEXEC，外部命令不会继承其他段的管道
+        if (i < n - 1) {
+            if (pipe2(fds, O_CLOEXEC) == -1) {
+                fprintf(stderr, "pipe error: %s\n", strerror(errno));
+            } else {
+                size_pipe(fds[1]);
+            }
         }
+        status = 127;
+        if (is_spawnable(stages[i])) {
+            pid = launch_cmd(stages[i], in_fd, fds[1], *pgid, child_mask, &status);
+        } else if (n > 1 && getexeccmd(stages[i])->argc > 0 &&
+                   (bi = builtin_lookup(getexeccmd(stages[i])->argv[0])) != NULL &&
+                   !(bi->flags & BI_PIPE)) {
+            fprintf(stderr, "%s: 不能在管道中使用\n", bi->name);
+            pid = -1;
+            status = 1;
+        } else {
+            if ((pid = fork()) == 0) {  // 内部命令，在子进程中运行
+                sigprocmask(SIG_SETMASK, child_mask, NULL);
+                close(sigfd);
+                close(epfd);
+                sigfd = epfd = -1;  // 子进程中等待子进程时不再使用 signalfd
+                setpgid(0, *pgid);
+                if (in_fd >= 0) {
+                    dup2(in_fd, 0);
+                    close(in_fd);
+                }
+                if (fds[1] >= 0) {
+                    dup2(fds[1], 1);
+                    close(fds[1]);
+                    close(fds[0]);
+                }
+                eval(cmdline, stages[i]);
+            }
+            if (pid > 0) {
+                setpgid(pid, *pgid ? *pgid : pid);
+            }
+        }
+        STATS_END(PH_SPAWN, t);
+        // 只有赋值的段没有命令名
+        procs[i].name = getexeccmd(stages[i])->argc ? getexeccmd(stages[i])->argv[0] : "";
+        if (trace_enabled) {
+            trace_span("spawn", start, stats_now(), pid > 0 ? pid : 0, pid > 0 ? (*pgid ? *pgid : pid) : 0,
+                       -1, procs[i].name);
+        }
+        procs[i].pid = pid > 0 ? pid : 0;
+        procs[i].termsig = 0;
+        clock_gettime(CLOCK_MONOTONIC, &procs[i].start);
+        procs[i].end = procs[i].start;
+        memset(&procs[i].ru, 0, sizeof(struct rusage));
+        if (pid > 0) {
+            procs[i].status = 0;
+            procs[i].done = 0;
+            if (*pgid == 0) {
+                *pgid = pid;
+            }
+            nlive++;
+        } else {
+            procs[i].status = status;
+            procs[i].done = 1;
+        }
+        // 父进程不再需要本段的输入和输出
+        if (in_fd >= 0) {
+            close(in_fd);
+        }
+        if (fds[1] >= 0) {
+            close(fds[1]);
+        }
+        in_fd = fds[0];
     }
-    return jid;
+    STATS_END(PH_LAUNCH, launch);
+    return nlive;
 }
 
 /**
- * deljob - 删除 jobs 数组中 pid 等于传入的 pid 的结构体
+ * pipeline_status - 计算管道的退出状态，默认为最后一段的状态，
+ * 设置 pipefail 时为最右边的非零状态
  */
-int deljob(pid_t pid) {
-    if (pid < 0) {
+int pipeline_status(struct proc_t *procs, int n) {
+    if (pipefail) {
+        for (int i = n - 1; i >= 0; i--) {
+            if (procs[i].status != 0) {
+                return procs[i].status;
+            }
+        }
         return 0;
     }
+    return procs[n - 1].status;
+}
 
-    for (int i = 0; i < MAXJOBS; i++) {
-        if (jobs[i].pid == pid) {
-            clearjob(&jobs[i]);
-            nextjid = maxjid() + 1;  // 设置下一个 jid
-            return 1;
+/**
+ * save_status - 保存前台作业的退出状态，供 status 命令输出
+ */
+void save_status(struct proc_t *procs, int n) {
+    last_status = pipeline_status(procs, n);
+    if (n > last_npipe) {
+        last_pipestatus = (int *)realloc(last_pipestatus, n * sizeof(int));
+    }
+    last_npipe = n;
+    for (int i = 0; i < n; i++) {
+        last_pipestatus[i] = procs[i].status;
+    }
+}
+
+/**
+ * run_job - 运行 command，shell 直接创建管道的每一段，并将它们放入同一个进程组中，
+ * 然后将作业加入作业表。前台作业等待整个作业结束或者被停止，
+ * 后台作业输出作业号和进程组号后立即返回。timed 非零时作业结束后输出资源使用情况
+ */
+void run_job(char *cmdline, struct cmd *command, struct arena *arena, int timed) {
+    struct cmd **stages;
+    pid_t pgid = 0;
+    int bg = command->fgbg;
+    int n = flatten_pipe(arena, command, &stages);
+    struct proc_t *procs = (struct proc_t *)arena_alloc(arena, n * sizeof(struct proc_t));
+
+    if (bg && maxjobs > 0 && (njobs_queued() > 0 || njobs_bg() >= maxjobs)) {
+        // 后台作业已经达到上限，先不创建进程，由 promote_queued 在有空位时启动
+        memset(procs, 0, n * sizeof(struct proc_t));
+        for (int i = 0; i < n; i++) {
+            procs[i].name = getexeccmd(stages[i])->argc ? getexeccmd(stages[i])->argv[0] : "";
         }
+        struct job_t *job = addjob(cmdline, bg, command, 0, procs, n, arena);
+        setjobstate(job, QD);
+        job->timed = timed;
+        printf("[%d] 排队 %s\n", job->jid, job->cmdline);
+        return;
     }
-    return 0;
+
+    // 子进程只在主循环中回收，addjob 之前不需要阻塞信号
+    int nlive = launch_pipeline(cmdline, stages, n, procs, &pgid, &child_mask);
+    if (nlive == 0) {   // 没有创建任何进程
+        save_status(procs, n);
+        arena_free(arena);
+        return;
+    }
+    struct job_t *job = addjob(cmdline, bg, command, pgid, procs, n, arena);
+    job->nlive = nlive;
+    job->timed = timed;
+    if (bg) {
+        printf("[%d] (%d) %s\n", job->jid, job->pid, job->cmdline);
+        return;
+    }
+    fgpid = pgid;
+    waitfg(pgid);
 }
 
 /**
- * getjobjid - 通过 jid 获得结构体
+ * start_job - 为排队的作业创建进程，作业转为 BG 状态。没有创建任何进程时删除作业，
+ * 返回 0，否则返回 1
  */
-struct job_t *getjobjid(int jid) {
-    for (int i = 0; i < MAXJOBS; i++) {
-        if (jobs[i].jid == jid) {
-            return &jobs[i];
+int start_job(struct job_t *job) {
+    struct cmd **stages;
+    pid_t pgid = 0;
+    int n = flatten_pipe(job->arena, job->command, &stages);
+    int nlive = launch_pipeline(job->cmdline, stages, n, job->procs, &pgid, &child_mask);
+
+    if (nlive == 0) {
+        deljobjid(job->jid);
+        return 0;
+    }
+    setjobpids(job, pgid);
+    job->nlive = nlive;
+    setjobstate(job, BG);
+    printf("[%d] (%d) %s\n", job->jid, job->pid, job->cmdline);
+    return 1;
+}
+
+/**
+ * promote_queued - 按照排队的顺序启动排队的作业，直到运行中的后台作业达到 maxjobs。
+ * 在 reap_children 回收作业之后和修改 maxjobs 之后调用
+ */
+void promote_queued(void) {
+    if (getpid() != shell_pid) {
+        return;
+    }
+    while (firstqueued() != NULL && (maxjobs == 0 || njobs_bg() < maxjobs)) {
+        start_job(firstqueued());
+    }
+}
+
+/**
+ * drain_queued - shell 退出之前调用，继续回收后台作业，直到排队的作业全部启动、
+ * 以 & 运行的 parallel 的任务全部完成，否则脚本最后用 & 运行的命令只会排队而不会运行。
+ * 期间收到 SIGINT 时放弃排队的作业和剩下的任务
+ */
+void drain_queued(void) {
+    struct pollfd pfd = { sigfd, POLLIN, 0 };
+    interrupted = 0;
+    promote_queued();
+    while (njobs_queued() > 0 || parallel_pending() > 0) {
+        if (interrupted) {
+            if (njobs_queued() > 0) {
+                fprintf(stderr, "已放弃 %d 个排队的作业\n", njobs_queued());
+            }
+            if (parallel_pending() > 0) {
+                fprintf(stderr, "parallel: 已放弃 %d 个后台运行的队列\n", parallel_pending());
+            }
+            return;
+        }
+        if (poll(&pfd, 1, -1) > 0) {
+            handle_signals();
         }
     }
-    return NULL;
 }
 
 /**
- * getjobpid - 通过 pid 获得结构体
+ * exec_pipeline - 在当前进程中运行管道并等待所有段结束，返回管道的退出状态，
+ * 用于 exec 命令，这时的进程不维护作业表
  */
-struct job_t *getjobpid(pid_t pid) {
-    for (int i = 0; i < MAXJOBS; i++) {
-        if (jobs[i].pid == pid) {
-            return &jobs[i];
+int exec_pipeline(char *cmdline, struct cmd *command, pid_t pgid) {
+    struct cmd **stages;
+    struct arena *arena = arena_new(0);
+    int n = flatten_pipe(arena, command, &stages);
+    struct proc_t *procs = (struct proc_t *)arena_alloc(arena, n * sizeof(struct proc_t));
+    int status;
+
+    launch_pipeline(cmdline, stages, n, procs, &pgid, &child_mask);
+    for (int i = 0; i < n; i++) {
+        if (procs[i].pid > 0 && waitpid(procs[i].pid, &status, 0) > 0) {
+            procs[i].status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
         }
     }
-    return NULL;
+    status = pipeline_status(procs, n);
+    arena_free(arena);
+    return status;
+}
+
+/**
+ * redir_fd - 打开 file 并复制到描述符 target，原来的 target 复制到
+ * 一个带有 FD_CLOEXEC 的新描述符中，通过 *saved 返回，target 原来没有打开时为 -1
+ */
+int redir_fd(const char *file, int flags, int target, int *saved) {
+    int fd = open(file, flags, MODE ^ mode);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", file, strerror(errno));
+        return -1;
+    }
+    *saved = fcntl(target, F_DUPFD_CLOEXEC, 10);
+    if (fd != target) {
+        dup2(fd, target);
+        close(fd);
+    }
+    return 0;
+}
+
+/**
+ * redir_restore - 恢复被 redir_fd 替换的描述符 target
+ */
+void redir_restore(int target, int saved) {
+    if (saved >= 0) {
+        dup2(saved, target);
+        close(saved);
+    } else {
+        close(target);
+    }
+}
+
+/**
+ * run_builtin - 若 command 为前台的内部命令，则在 shell 进程中运行，设置退出状态并返回 1；
+ * 带有重定向的内部命令先在 shell 中保存并替换标准输入输出，运行后再恢复，不需要创建进程；
+ * 以 exec 开头并带有命令的，用该命令替换 shell，不返回；否则返回 0，交给 run_foreground
+ */
+int run_builtin(struct cmd *command) {
+    struct execcmd *exec_cmd = getexeccmd(command);
+    struct redircmd *redir_cmd = NULL;
+    struct proc_t proc = { 0, 1, 0, 1 };
+    int saved[2] = { -1, -1 };
+    const struct builtin *bi;
+
+    if (command->type != PIPE && exec_cmd->argc == 0) {
+        // 展开之后为空的命令什么也不做，赋值命令在 shell 中设置变量，
+        // 状态为最后一个命令替换的状态，如 x=$(false) 的状态为 1
+        for (int i = 0; i < exec_cmd->nassign; i++) {
+            var_assign(exec_cmd->assign[i], 0);
+        }
+        proc.status = subst_status >= 0 ? subst_status : 0;
+        save_status(&proc, 1);
+        return 1;
+    }
+    if (exec_cmd->argc > 1 && strcmp(exec_cmd->argv[0], "exec") == 0) {
+        exec_imp(command);
+    }
+    if (command->type == REDIR) {
+        redir_cmd = (struct redircmd *)command;
+        if (redir_cmd->command->type != EXEC) {
+            return 0;
+        }
+    } else if (command->type != EXEC) {
+        return 0;
+    }
+    if ((bi = builtin_lookup(exec_cmd->argv[0])) == NULL) {
+        return 0;
+    }
+    // 与 POSIX 的特殊内部命令一样，内部命令之前的赋值在 shell 中保持有效
+    for (int i = 0; i < exec_cmd->nassign; i++) {
+        var_assign(exec_cmd->assign[i], 0);
+    }
+    if (redir_cmd == NULL) {
+        STATS_START(t);
+        proc.status = bi->fn(exec_cmd->argc, exec_cmd->argv);
+        STATS_END(PH_BUILTIN, t);
+        save_status(&proc, 1);
+        return 1;
+    }
+
+    uint64_t start = trace_enabled ? stats_now() : 0;
+    fflush(stdout);     // 缓冲区中的内容属于原来的标准输出
+    if (redir_cmd->in_file && redir_fd(redir_cmd->in_file, O_RDONLY, 0, &saved[0]) < 0) {
+        save_status(&proc, 1);
+        return 1;
+    }
+    if (redir_cmd->out_file && redir_fd(redir_cmd->out_file, redir_cmd->mode, 1, &saved[1]) < 0) {
+        if (redir_cmd->in_file) {
+            redir_restore(0, saved[0]);
+        }
+        save_status(&proc, 1);
+        return 1;
+    }
+    if (trace_enabled) {
+        trace_span("redirect", start, stats_now(), 0, 0, -1,
+                   redir_cmd->out_file ? redir_cmd->out_file : redir_cmd->in_file);
+    }
+    STATS_START(t);
+    proc.status = bi->fn(exec_cmd->argc, exec_cmd->argv);
+    STATS_END(PH_BUILTIN, t);
+    fflush(stdout);
+    if (bi->fn == exec_builtin) {   // 不带命令的 exec，重定向对 shell 永久有效
+        for (int i = 0; i < 2; i++) {
+            if (saved[i] >= 0) {
+                close(saved[i]);
+            }
+        }
+    } else {
+        if (redir_cmd->in_file) {
+            redir_restore(0, saved[0]);
+        }
+        if (redir_cmd->out_file) {
+            redir_restore(1, saved[1]);
+        }
+    }
+    save_status(&proc, 1);
+    return 1;
+}
+
+/**
+ * shift_args - 若 exec_cmd 的第一个参数为 word 并且后面还有参数，
+ * 则去掉第一个参数，将其余参数向前移动一位，并返回 1，否则返回 0
+ */
+int shift_args(struct execcmd *exec_cmd, const char *word) {
+    if (exec_cmd->argc < 2 || strcmp(exec_cmd->argv[0], word) != 0) {
+        return 0;
+    }
+    for (int i = 0; i < exec_cmd->argc; i++) {
+        exec_cmd->argv[i] = exec_cmd->argv[i + 1];
+    }
+    exec_cmd->argc--;
+    return 1;
+}
+
+/**
+ * time_builtin - 若 time 后面为在 shell 中运行的内部命令，则运行它，
+ * 用 shell 进程自身的资源使用情况的差值作为命令的资源使用情况，返回 1；否则返回 0
+ */
+int time_builtin(struct cmd *command) {
+    struct proc_t proc;
+    struct rusage before, after;
+    struct usage u;
+
+    clock_gettime(CLOCK_MONOTONIC, &proc.start);
+    getrusage(RUSAGE_SELF, &before);
+    if (!run_builtin(command)) {
+        return 0;
+    }
+    getrusage(RUSAGE_SELF, &after);
+    clock_gettime(CLOCK_MONOTONIC, &proc.end);
+    proc.pid = getpid();
+    proc.done = 1;
+    proc.ru = after;
+    timersub(&after.ru_utime, &before.ru_utime, &proc.ru.ru_utime);
+    timersub(&after.ru_stime, &before.ru_stime, &proc.ru.ru_stime);
+    proc.ru.ru_nvcsw -= before.ru_nvcsw;
+    proc.ru.ru_nivcsw -= before.ru_nivcsw;
+    proc_usage(&proc, &u);
+    fflush(stdout);
+    print_usage_header(stderr);
+    print_usage(stderr, &u, getexeccmd(command)->argv[0]);
+    return 1;
+}
+
+/**
+ * report_time - 输出由 time 运行的作业的资源使用情况，多段的管道先输出每一段，再输出总计
+ */
+void report_time(struct job_t *job) {
+    struct usage u;
+    fflush(stdout);
+    print_usage_header(stderr);
+    for (int i = 0; job->nproc > 1 && i < job->nproc; i++) {
+        proc_usage(&job->procs[i], &u);
+        print_usage(stderr, &u, job->procs[i].name);
+    }
+    job_usage(job, &u);
+    print_usage(stderr, &u, job->nproc > 1 ? "(total)" : job->procs[0].name);
+}
+
+/**
+ * exec_imp - 用 command 替换 shell，command 第一段开头的 exec 会被去掉
+ */
+void exec_imp(struct cmd *command) {
+    struct execcmd *exec_cmd = getexeccmd(command);
+
+    shift_args(exec_cmd, "exec");
+    fflush(stdout);
+    trace_flush();
+    sigprocmask(SIG_SETMASK, &child_mask, NULL);    // 替换 shell 之后不再使用 signalfd
+    switch (command->type) {
+        case EXEC:  // 直接执行
+            run_exec(exec_cmd);
+            break;
+        case PIPE:  // 管道
+            exit(exec_pipeline(exec_cmd->argv[0], command, 0));
+            break;
+        case REDIR: // 重定向
+            execredir((struct redircmd *)command);
+            break;
+    }
+}
+
+/**
+ * exec_builtin - exec 内部命令，没有参数时什么也不做，
+ * 否则用参数中的命令替换当前进程
+ */
+int exec_builtin(int argc, char *argv[]) {
+    if (argc < 2) {
+        return 0;
+    }
+    fflush(stdout);
+    struct execcmd exec_cmd = { EXEC, 0, argc - 1, argv + 1 };
+    run_exec(&exec_cmd);
+    return 127;
+}
+
+/**
+ * jobs_imp - jobs 内部命令，列出所有作业，jobs -l 同时输出每个作业及其每一段的资源使用情况
+ */
+int jobs_imp(int argc, char *argv[]) {
+    listjobs(argc > 1 && strcmp(argv[1], "-l") == 0);
+    return 0;
+}
+
+/**
+ * test_parse - 测试解析的结果
+ */
+void test_parse(struct cmd *command) {
+    struct execcmd *exec_cmd;
+    struct pipecmd *pipe_cmd;
+    struct redircmd *redir_cmd;
+    printf("%s\n", command->fgbg ? "bg" : "fg");
+    switch (command->type) {
+        case EXEC:
+            exec_cmd = (struct execcmd *)command;
+            printf("exec:\n");
+            char *str = exec_cmd->argv[0];
+            for (int i = 0; str; i++, str = exec_cmd->argv[i]) {
+                printf("%s\n", str);
+            }
+            break;
+        case PIPE:
+            pipe_cmd = (struct pipecmd *)command;
+            printf("pipe:\n");
+            printf("left:\n");
+            test_parse(pipe_cmd->left);
+            printf("right:\n");
+            test_parse(pipe_cmd->right);
+            break;
+        case REDIR:
+            redir_cmd = (struct redircmd *)command;
+            printf("redir:\n");
+            printf("in_file: %s\n", redir_cmd->in_file ? redir_cmd->in_file : "");
+            printf("out_file: %s\n", redir_cmd->out_file ? redir_cmd->out_file : "");
+            break;
+    }
 }
 
 /**
@@ -805,26 +1328,26 @@ struct job_t *getjobpid(pid_t pid) {
  */
 int fg_imp(int argc, char *argv[]) {
     int jid;
-    if (*argv[1] == '%') {
+    if (argc < 2) {     // 没有参数时使用最近的作业
+        jid = maxjid();
+    } else if (*argv[1] == '%') {
         jid = atoi(argv[1] + 1);
     } else {
         jid = atoi(argv[1]);
     }
-    sigset_t oldmask, mask;
-    sigfillset(&mask);
-    // 保护 jobs 数组
-    sigprocmask(SIG_BLOCK, &mask, &oldmask);
     struct job_t *job = getjobjid(jid);
-    sigprocmask(SIG_SETMASK, &oldmask, NULL);
     if (job == NULL) {
-        fprintf(stderr, "fg: %s: 无此任务\n", argv[1]);
+        fprintf(stderr, "fg: %s: 无此任务\n", argc < 2 ? "current" : argv[1]);
         return 1;
     }
-    fgpid = job->pid;
-    sigprocmask(SIG_BLOCK, &mask, NULL);
-    job->state = FG;        // 设置 job 的状态为 FG
-    sigprocmask(SIG_SETMASK, &oldmask, NULL);
-    kill(-fgpid, SIGCONT);  // 传递 SIGCONT 信号，恢复运行
+    if (job->state == QD && !start_job(job)) {  // 排队的作业不再等待空位
+        return 1;
+    }
+    pid_t pgid = job->pid;
+    fgpid = pgid;
+    setjobstate(job, FG);   // 设置 job 的状态为 FG
+    kill(-pgid, SIGCONT);   // 传递 SIGCONT 信号，恢复运行
+    waitfg(pgid);
     return 0;
 }
 
@@ -833,148 +1356,369 @@ int fg_imp(int argc, char *argv[]) {
  */
 int bg_imp(int argc, char *argv[]) {
     int jid;
-    if (*argv[1] == '%') {
+    if (argc < 2) {     // 没有参数时使用最近的作业
+        jid = maxjid();
+    } else if (*argv[1] == '%') {
         jid = atoi(argv[1] + 1);
     } else {
         jid = atoi(argv[1]);
     }
-    sigset_t oldmask, mask;
-    sigfillset(&mask);
-    // 保护 jobs 数组
-    sigprocmask(SIG_BLOCK, &mask, &oldmask);
     struct job_t *job = getjobjid(jid);
-    sigprocmask(SIG_SETMASK, &oldmask, NULL);
     if (job == NULL) {
-        fprintf(stderr, "fg: %s: 无此任务\n", argv[1]);
+        fprintf(stderr, "bg: %s: 无此任务\n", argc < 2 ? "current" : argv[1]);
         return 1;
     }
-    sigprocmask(SIG_BLOCK, &mask, NULL);
-    job->state = BG;    // 设置 job 的状态为 BG
-    sigprocmask(SIG_SETMASK, &oldmask, NULL);
+    if (job->state == QD) {     // 排队的作业立即启动，不再等待空位
+        return !start_job(job);
+    }
+    setjobstate(job, BG);   // 设置 job 的状态为 BG
     kill(-job->pid, SIGCONT);  // 传递 SIGCONT 信号，恢复运行
     return 0;
 }
 
+/**
+ * parse_signal - 将信号名（可以带有 SIG 前缀）或者信号编号转换为信号，无效时返回 -1
+ */
+static int parse_signal(const char *s) {
+    static const struct {
+        const char *name;
+        int sig;
+    } sigs[] = {
+        { "HUP", SIGHUP }, { "INT", SIGINT }, { "QUIT", SIGQUIT }, { "ABRT", SIGABRT },
+        { "KILL", SIGKILL }, { "USR1", SIGUSR1 }, { "USR2", SIGUSR2 }, { "PIPE", SIGPIPE },
+        { "ALRM", SIGALRM }, { "TERM", SIGTERM }, { "CHLD", SIGCHLD }, { "CONT", SIGCONT },
+        { "STOP", SIGSTOP }, { "TSTP", SIGTSTP }, { "TTIN", SIGTTIN }, { "TTOU", SIGTTOU },
+        { "WINCH", SIGWINCH },
+    };
+    char *end;
+    if (isdigit((unsigned char)*s)) {
+        long sig = strtol(s, &end, 10);
+        return *end == '\0' && sig < NSIG ? (int)sig : -1;
+    }
+    if (strncmp(s, "SIG", 3) == 0) {
+        s += 3;
+    }
+    for (size_t i = 0; i < sizeof(sigs) / sizeof(sigs[0]); i++) {
+        if (strcmp(s, sigs[i].name) == 0) {
+            return sigs[i].sig;
+        }
+    }
+    return -1;
+}
 
 /**
- * waitfg - 等待前台进程完成
+ * kill_imp - kill 内部命令，向作业（%作业号）或者进程发送信号，默认为 SIGTERM。
+ * 排队的作业还没有进程，收到会终止进程的信号时直接从队列中删除
  */
-void waitfg() {
-    sigset_t mask;
-    sigemptyset(&mask);
-    // 当 fgpid 未被 sigchld_handler 清空时，
-    // 阻塞进程，若收到信号，则调用信号处理函数，
-    // 如果 fgpid 被清空，则退出循环，否则，持续循环
-    while (fgpid != 0) {
-        sigsuspend(&mask);
+int kill_imp(int argc, char *argv[]) {
+    int sig = SIGTERM, ret = 0, i = 1;
+    char *end;
+
+    if (argc > 1 && argv[1][0] == '-' && argv[1][1] != '\0') {
+        if ((sig = parse_signal(argv[1] + 1)) < 0) {
+            fprintf(stderr, "kill: %s: 无效的信号\n", argv[1] + 1);
+            return 1;
+        }
+        i++;
+    }
+    if (i >= argc) {
+        fprintf(stderr, "用法: kill [-信号] <%%作业号 | 进程号 ...>\n");
+        return 2;
     }
+    for (; i < argc; i++) {
+        pid_t target;
+        if (argv[i][0] == '%') {
+            struct job_t *job = getjobjid(atoi(argv[i] + 1));
+            if (job == NULL) {
+                fprintf(stderr, "kill: %s: 无此任务\n", argv[i]);
+                ret = 1;
+                continue;
+            }
+            if (job->state == QD) {
+                if (sig != 0 && sig != SIGCONT && sig != SIGCHLD && sig != SIGWINCH &&
+                    sig != SIGSTOP && sig != SIGTSTP && sig != SIGTTIN && sig != SIGTTOU) {
+                    printf("[%d] 已从队列中删除 %s\n", job->jid, job->cmdline);
+                    deljobjid(job->jid);
+                }
+                continue;
+            }
+            target = -job->pid;
+        } else {
+            target = strtol(argv[i], &end, 10);
+            if (end == argv[i] || *end != '\0') {
+                fprintf(stderr, "kill: %s: 需要进程号或者 %%作业号\n", argv[i]);
+                ret = 1;
+                continue;
+            }
+        }
+        if (kill(target, sig) < 0) {
+            fprintf(stderr, "kill: %s: %s\n", argv[i], strerror(errno));
+            ret = 1;
+        }
+    }
+    return ret;
 }
 
+
+#ifndef NO_STATS
 /**
- * listjobs - 列出 jobs 数组中所有状态不为 INVALID 的结构体
+ * last_reaped - 返回作业中最后一个进程被 reap_children 回收的时间（纳秒）
  */
-void listjobs() {
-    for (int i = 0; i < MAXJOBS; i++) {
-        if (jobs[i].state != INVALID) {
-            printf("[%d] (%d) ", jobs[i].jid, jobs[i].pid);
-            switch (jobs[i].state) {
-                case BG: 
-                    printf("Running ");
-                    break;
-                case FG: 
-                    printf("Foreground ");
-                    break;
-                case ST: 
-                    printf("Stopped ");
-                    break;
-                default:
-                    printf("listjobs: Internal error: job[%d].state=%d ", 
-                    i, jobs[i].state);
+static uint64_t last_reaped(const struct job_t *job) {
+    uint64_t last = 0;
+    for (int i = 0; i < job->nproc; i++) {
+        if (job->procs[i].pid > 0 && ts_ns(&job->procs[i].end) > last) {
+            last = ts_ns(&job->procs[i].end);
+        }
+    }
+    return last;
+}
+#endif
+
+/**
+ * waitfg - 等待进程组为 pgid 的前台作业完成或被停止，作业完成时保存退出状态并删除作业，
+ * 作业可能在调用之前就已经结束，因此由调用者传入 pgid，而不是读取 fgpid
+ */
+void waitfg(pid_t pgid) {
+    struct pollfd pfd = { sigfd, POLLIN, 0 };
+    int waited = 0;
+    STATS_START(t);
+    // 只等待信号，不监听标准输入，用户提前输入的命令留在管道中。
+    // 当 fgpid 被 reap_children 清空时，作业已经结束或者被停止
+    while (fgpid != 0 && fgpid == pgid) {
+        waited = 1;
+        if (poll(&pfd, 1, -1) > 0) {
+            handle_signals();
+        }
+    }
+    struct job_t *job = getjobpid(pgid);
+    if (waited && job != NULL && job->nlive == 0) {  // 调用之前就已经结束的作业不记录
+        STATS_AFTER(PH_WAKEUP, last_reaped(job));
+    }
+    STATS_END(PH_WAIT, t);
+    if (job != NULL && job->nlive == 0) {   // 整个作业已经结束
+        save_status(job->procs, job->nproc);
+        if (job->timed) {
+            report_time(job);
+        }
+        deljob(pgid);
+    }
+}
+
+/**
+ * listjobs - 按 jid 从小到大列出所有的作业，verbose 非零时在每个作业之后输出
+ * 每一段和整个作业的资源使用情况，最后输出最近结束的后台作业
+ */
+void listjobs(int verbose) {
+    struct job_t *job;
+    struct usage u;
+    char what[MAXLEN];
+    int jid = 0;
+    if (verbose) {
+        print_usage_header(stdout);
+    }
+    while ((job = nextjob(&jid)) != NULL) {
+        if (job->state == QD) {     // 还没有进程组
+            printf("[%d] (-) ", job->jid);
+        } else {
+            printf("[%d] (%d) ", job->jid, job->pid);
+        }
+        switch (job->state) {
+            case BG: 
+                printf("Running ");
+                break;
+            case FG: 
+                printf("Foreground ");
+                break;
+            case ST: 
+                printf("Stopped ");
+                break;
+            case QD:
+                printf("Queued ");
+                break;
+            default:
+                printf("listjobs: Internal error: job[%d].state=%d ", 
+                jid, job->state);
+        }
+        printf("%s\n", job->cmdline);
+        if (!verbose) {
+            continue;
+        }
+        for (int i = 0; i < job->nproc; i++) {
+            struct proc_t *proc = &job->procs[i];
+            proc_usage(proc, &u);
+            if (proc->done) {
+                snprintf(what, sizeof(what), "  %d %s (%d)", proc->pid, proc->name, proc->status);
+            } else {
+                snprintf(what, sizeof(what), "  %d %s", proc->pid, proc->name);
             }
-            printf("%s\n", jobs[i].cmdline);
+            print_usage(stdout, &u, what);
         }
+        job_usage(job, &u);
+        print_usage(stdout, &u, "(total)");
+    }
+    if (verbose) {
+        list_done(stdout);
     }
 }
 
 /******************************
- * 信号处理函数
+ * 事件循环
 ********************************/
-handler_t *Signal(int signum, handler_t *handler) {
-    struct sigaction action, oldaction;
 
-    sigemptyset(&action.sa_mask);
-    action.sa_handler = handler;
-    action.sa_flags = SA_RESTART;
+/**
+ * event_init - 阻塞 SIGCHLD、SIGINT 和 SIGTSTP，改为通过 signalfd 读取，
+ * 这三个信号从此只在主循环中同步处理，作业表不再需要用 sigprocmask 保护。
+ * 交互模式下标准输入也加入 epoll，等待输入的同时可以处理信号
+ */
+void event_init(int interactive) {
+    struct epoll_event ev;
+    sigset_t mask;
 
-    if (sigaction(signum, &action, &oldaction) < 0) {
-        fprintf(stderr, "Signal error\n");
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTSTP);
+    sigprocmask(SIG_BLOCK, &mask, &child_mask);
+    if ((sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0 ||
+        (epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        fprintf(stderr, "event_init error: %s\n", strerror(errno));
         exit(1);
     }
-    return (oldaction.sa_handler);
+    ev.events = EPOLLIN;
+    ev.data.fd = sigfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, sigfd, &ev);
+    if (interactive) {
+        ev.data.fd = 0;
+        // 普通文件不能加入 epoll，这时直接读入，读入总是不会阻塞
+        input_polled = epoll_ctl(epfd, EPOLL_CTL_ADD, 0, &ev) == 0;
+    }
 }
 
 /**
- * sigchld_handler - 当子进程退出，或被停止，或被用户中断时，调用该函数，
- * 该函数调用 waitpid 获得当前退出或停止的子进程的 pid，然后判断是否为当前的前台进程，
- * 若是，则清空 fgpid；若不是，则判断当前进程退出的原因，若是被停止或中断，则输出
- * 相关的信息
- * 注意，我们要使用 while 循环，因为当这个函数被调用时，可能此时有多个子进程需要处理
+ * handle_signals - 读出 signalfd 中所有的信号并处理，没有信号时立即返回。
+ * SIGINT 和 SIGTSTP 传递给前台进程组，SIGCHLD 回收结束或者停止的子进程
  */
-void sigchld_handler(int sig) {
-    sigset_t oldmask, mask;
-    pid_t pid;
-    int status;
-
-    while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED)) > 0) {
-        sigfillset(&mask);
-        sigprocmask(SIG_BLOCK, &mask, &oldmask);
-        if (fgpid == pid) {  // 当前的前台进程
-            fgpid = 0;
-        }
-        if (WIFEXITED(status)) {          // 正常退出
-            deljob(pid);
-        } else if (WIFSTOPPED(status)) {  // SIGTSTP
-            struct job_t *job = getjobpid(pid);
-            printf("[%d] (%d) 已停止 %s\n", job->jid, job->pid, job->cmdline);
-            job->state = ST;
-        } else if (WIFSIGNALED(status)) {  // SIGINT
-            struct job_t *job = getjobpid(pid);
-            printf("Job [%d] (%d) 被信号终止\n", job->jid, job->pid);
-            deljob(pid);
+void handle_signals(void) {
+    struct signalfd_siginfo info[16];
+    ssize_t n;
+    int chld = 0;
+
+    while ((n = read(sigfd, info, sizeof(info))) > 0) {
+        for (int i = 0; i < n / (ssize_t)sizeof(info[0]); i++) {
+            switch (info[i].ssi_signo) {
+                case SIGCHLD:   // 多个 SIGCHLD 会合并，由 reap_children 一次回收
+                    chld = 1;
+                    break;
+                case SIGINT:    // ctrl + c
+                    interrupted = 1;
+                    // fall through
+                case SIGTSTP:   // ctrl + z
+                    if (fgpid != 0) {
+                        kill(-fgpid, info[i].ssi_signo);    // 向前台进程组传递信号
+                    }
+                    break;
+            }
         }
-        sigprocmask(SIG_SETMASK, &oldmask, &mask);
+    }
+    if (chld) {
+        STATS_START(t);
+        reap_children();
+        STATS_END(PH_REAP, t);
     }
 }
 
 /**
- * sigint_handler - 当传递 sigint 信号时调用函数，用户在 shell 中输入
- * ctrl+c，sigint 信号将传递给 shell，shell 进程将信号发送给当前的前台进程组
+ * wait_input - 等待 in 中有完整的一行，等待期间处理到达的信号，
+ * 因此后台作业结束时可以立即被回收
  */
-void sigint_handler(int sig) {
-    sigset_t mask, oldmask;
-    sigfillset(&mask);
-    sigprocmask(SIG_BLOCK, &mask, &oldmask);
-    if (fgpid == 0) {
-        sigprocmask(SIG_SETMASK, &oldmask, NULL);
-        return;
+void wait_input(struct reader *in) {
+    struct epoll_event evs[2];
+    int n;
+
+    while (!reader_has_line(in)) {
+        if (!input_polled) {
+            reader_fill(in);
+            continue;
+        }
+        if ((n = epoll_wait(epfd, evs, 2, -1)) < 0) {
+            continue;
+        }
+        for (int i = 0; i < n; i++) {
+            if (evs[i].data.fd == sigfd) {
+                handle_signals();
+            } else {
+                reader_fill(in);
+            }
+        }
     }
-    sigprocmask(SIG_SETMASK, &oldmask, NULL);
-    kill(-fgpid, sig);  // 向前台进程组传递信号
 }
 
 /**
- * sigtstp_handler - 当传递 sigstop 信号时调用函数，用户在 shell 中输入
- * ctrl+z，sigstop 信号将传递给 shell，shell 进程将信号发送给当前的前台进程组，
- * 停止前台进程
+ * reap_children - 调用 wait4 回收所有结束或被停止的子进程，然后找到该进程所在的作业。
+ * 若进程被停止，则停止整个作业；若进程结束，则记录它的状态，当作业中所有的进程都
+ * 结束时，若为前台作业，则清空 fgpid，由 waitfg 删除作业，否则直接删除作业。
+ * 只在主循环中调用，因此可以安全地输出和释放内存
  */
-void sigtstp_handler(int sig) {
-    sigset_t mask, oldmask;
-    sigfillset(&mask);
-    sigprocmask(SIG_BLOCK, &mask, &oldmask);
-    if (fgpid == 0) {
-        sigprocmask(SIG_SETMASK, &oldmask, NULL);
-        return;
+void reap_children(void) {
+    struct rusage ru;
+    pid_t pid;
+    int status;
+
+    while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED, &ru)) > 0) {
+        struct job_t *job = getjobpid(pid);
+        if (job == NULL) {
+            continue;
+        }
+        if (WIFSTOPPED(status)) {  // SIGTSTP
+            if (job->state != ST) {
+                printf("[%d] (%d) 已停止 %s\n", job->jid, job->pid, job->cmdline);
+                setjobstate(job, ST);
+            }
+            if (fgpid == job->pid) {  // 当前的前台作业
+                fgpid = 0;
+            }
+        } else {    // 正常退出或被信号终止
+            struct proc_t *proc = getjobproc(job, pid);
+            if (proc != NULL && !proc->done) {
+                proc->done = 1;
+                proc->ru = ru;
+                clock_gettime(CLOCK_MONOTONIC, &proc->end);
+                if (WIFEXITED(status)) {
+                    proc->status = WEXITSTATUS(status);
+                } else {    // SIGINT
+                    proc->termsig = WTERMSIG(status);
+                    proc->status = 128 + proc->termsig;
+                }
+                if (trace_enabled) {
+                    trace_proc(proc->name, ts_ns(&proc->start), ts_ns(&proc->end), pid, job->pid,
+                               proc->status);
+                }
+                job->nlive--;
+            } else if (proc == NULL) {  // 没有记录每一段进程的作业
+                job->nlive = 0;
+            }
+            if (job->nlive <= 0) {
+                for (int i = 0; i < job->nproc; i++) {
+                    if (job->procs[i].termsig) {
+                        printf("Job [%d] (%d) 被信号终止\n", job->jid, job->pid);
+                        break;
+                    }
+                }
+                if (fgpid == job->pid) {  // 当前的前台作业
+                    fgpid = 0;
+                }
+                if (job->queue != NULL) {   // parallel 的任务，由队列记录状态并启动下一个任务
+                    parallel_reaped(job);
+                } else if (job->state != FG) {
+                    if (job->timed) {
+                        report_time(job);
+                    }
+                    save_done(job);
+                    deljob(job->pid);
+                }
+            }
+        }
     }
-    sigprocmask(SIG_SETMASK, &oldmask, NULL);
-    kill(-fgpid, sig);  // 向前台进程组传递信号
-}
\ No newline at end of file
+    promote_queued();   // 结束或停止的后台作业空出了位置
+}
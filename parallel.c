@@ -0,0 +1,461 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "built_in_command.h"
+#include "cmd.h"
+#include "jobs.h"
+#include "parallel.h"
+#include "var.h"
+
+#define COPY_CHUNK 65536
+#define ARG_RESERVE 4096    // execve 自己需要的空间，不用于参数
+
+extern sigset_t child_mask;
+extern int sigfd;
+extern int interrupted;
+extern int builtin_bg;
+
+int launch_pipeline(char *cmdline, struct cmd **stages, int n, struct proc_t *procs,
+                    pid_t *pgid, const sigset_t *child_mask);
+void handle_signals(void);
+void reap_children(void);
+void redir_restore(int target, int saved);
+
+/*
+ * parallel 把参数分成若干个任务，每个任务运行一次命令，同时最多运行 maxrun 个。
+ * 每个任务都是作业表中的一个后台作业，可以通过 jobs 看到；reap_children 回收一个任务时
+ * 调用 parallel_reaped，由它立即启动下一个任务，因此任何时候都正好有 maxrun 个任务在运行。
+ * 前台运行时 parallel 等待所有的任务结束，以 & 运行时立即返回，之后的任务完全由回收推进
+ */
+
+enum task_state { TASK_WAIT, TASK_RUN, TASK_DONE };
+
+static int npending = 0;    // 以 & 运行、还没有完成的队列数
+
+/**
+ * 一个任务，即一次 exec，参数为 q->args[first, first + n)
+ */
+struct ptask {
+    int first;
+    int n;
+    enum task_state state;
+    int status;
+    pid_t pid;      // 任务的进程号
+    int fd;         // -k 时保存输出的匿名文件，否则为 -1
+};
+
+/**
+ * 一次 parallel 命令的任务队列
+ */
+struct pqueue {
+    struct arena *arena;    // 命令和参数的副本都从中分配
+    char **cmd;             // 命令和固定的参数
+    int ncmd;
+    int brace;              // cmd 中 {} 的位置，参数替换它，-1 表示参数加在命令之后
+    char **args;
+    int nargs;
+    struct ptask *tasks;
+    int ntasks;
+    int maxrun;     // 同时运行的任务数
+    int keep;       // -k：按照任务的顺序输出
+    int bg;         // 以 & 运行，parallel 已经返回
+    int next;       // 下一个要启动的任务
+    int running;
+    int flushed;    // -k：下一个要输出的任务
+    int failed;     // 状态非零的任务数
+    int stopped;    // 收到 SIGINT，不再启动新的任务
+    pid_t pgid;     // 任务加入的进程组，0 表示每个任务一个新的进程组
+};
+
+/**
+ * arg_limit - 一次 exec 的参数最多可以占用的字节数，ARG_MAX 减去环境占用的空间
+ */
+static size_t arg_limit(void) {
+    long max = sysconf(_SC_ARG_MAX);
+    size_t env = 0;
+    for (char **e = var_environ(); *e != NULL; e++) {
+        env += strlen(*e) + 1 + sizeof(char *);
+    }
+    if (max <= 0 || (size_t)max < env + 2 * ARG_RESERVE) {
+        return ARG_RESERVE;
+    }
+    return max - env - ARG_RESERVE;
+}
+
+/**
+ * read_args - 从标准输入读入参数，每行一个，忽略空行，参数从 q->arena 中分配
+ */
+static void read_args(struct pqueue *q) {
+    size_t cap = COPY_CHUNK, len = 0;
+    char *buf = (char *)malloc(cap);
+    ssize_t r;
+    int acap = 0;
+
+    while ((r = read(0, buf + len, cap - len)) != 0) {
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        len += r;
+        if (len == cap) {
+            cap *= 2;
+            buf = (char *)realloc(buf, cap);
+        }
+    }
+    for (char *p = buf, *end = buf + len; p < end;) {
+        char *nl = (char *)memchr(p, '\n', end - p);
+        if (nl == NULL) {
+            nl = end;
+        }
+        if (nl > p) {
+            if (q->nargs == acap) {
+                acap = acap ? acap * 2 : 64;
+                char **v = (char **)arena_alloc(q->arena, acap * sizeof(char *));
+                if (q->nargs > 0) {
+                    memcpy(v, q->args, q->nargs * sizeof(char *));
+                }
+                q->args = v;
+            }
+            q->args[q->nargs++] = arena_strndup(q->arena, p, nl - p);
+        }
+        p = nl + 1;
+    }
+    free(buf);
+}
+
+/**
+ * make_tasks - 将参数分成任务，每个任务最多 batch 个参数，
+ * 并且命令和参数的总大小不超过 arg_limit
+ */
+static void make_tasks(struct pqueue *q, int batch) {
+    size_t limit = arg_limit();
+    size_t fixed = sizeof(char *);  // argv 最后的 NULL
+    for (int i = 0; i < q->ncmd; i++) {
+        if (i != q->brace) {
+            fixed += strlen(q->cmd[i]) + 1 + sizeof(char *);
+        }
+    }
+    // 每个任务至少有一个参数，因此任务数不超过参数个数
+    q->tasks = (struct ptask *)malloc((q->nargs ? q->nargs : 1) * sizeof(struct ptask));
+    for (int i = 0; i < q->nargs;) {
+        size_t size = fixed;
+        int n = 0;
+        while (i + n < q->nargs && n < batch) {
+            size_t s = strlen(q->args[i + n]) + 1 + sizeof(char *);
+            if (n > 0 && size + s > limit) {
+                break;
+            }
+            size += s;
+            n++;
+        }
+        struct ptask *t = &q->tasks[q->ntasks++];
+        t->first = i;
+        t->n = n;
+        t->state = TASK_WAIT;
+        t->status = 0;
+        t->pid = 0;
+        t->fd = -1;
+        i += n;
+    }
+}
+
+/**
+ * copy_out - 将匿名文件 fd 中保存的输出写到标准输出
+ */
+static void copy_out(int fd) {
+    static char buf[COPY_CHUNK];
+    ssize_t n;
+    fflush(stdout);
+    lseek(fd, 0, SEEK_SET);
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        for (ssize_t off = 0, w; off < n; off += w) {
+            if ((w = write(1, buf + off, n - off)) < 0) {
+                if (errno == EINTR) {
+                    w = 0;
+                    continue;
+                }
+                return;
+            }
+        }
+    }
+}
+
+/**
+ * task_start - 启动第 k 个任务并加入作业表，创建失败时任务直接结束，状态为 127
+ */
+static void task_start(struct pqueue *q, int k) {
+    struct ptask *t = &q->tasks[k];
+    struct arena *a = arena_new(0);
+    int argc = q->ncmd + t->n - (q->brace >= 0);
+    char **argv = (char **)arena_alloc(a, (argc + 1) * sizeof(char *));
+    struct proc_t *procs = (struct proc_t *)arena_alloc(a, sizeof(struct proc_t));
+    struct cmd *command;
+    pid_t pgid = q->pgid;
+    size_t len = 0;
+    int saved = -1, n = 0;
+
+    for (int i = 0; i < q->ncmd; i++) {
+        if (i == q->brace) {
+            memcpy(argv + n, q->args + t->first, t->n * sizeof(char *));
+            n += t->n;
+        } else {
+            argv[n++] = q->cmd[i];
+        }
+    }
+    if (q->brace < 0) {
+        memcpy(argv + n, q->args + t->first, t->n * sizeof(char *));
+        n += t->n;
+    }
+    argv[n] = NULL;
+    // 作业的命令行为展开后的命令，jobs 中可以看到每个任务的参数
+    for (int i = 0; i < argc; i++) {
+        len += strlen(argv[i]) + 1;
+    }
+    char *cmdline = (char *)arena_alloc(a, len + 1);
+    char *p = cmdline;
+    for (int i = 0; i < argc; i++) {
+        p = stpcpy(p, argv[i]);
+        *p++ = ' ';
+    }
+    p[-1] = '\0';
+    command = create_execcmd(a, argc, argv);
+
+    if (q->keep && (t->fd = memfd_create("parallel", MFD_CLOEXEC)) >= 0) {
+        // 创建期间标准输出换成这个任务的匿名文件，任务结束后再按顺序输出
+        fflush(stdout);
+        saved = fcntl(1, F_DUPFD_CLOEXEC, 10);
+        dup2(t->fd, 1);
+    }
+    int nlive = launch_pipeline(cmdline, &command, 1, procs, &pgid, &child_mask);
+    if (t->fd >= 0) {
+        redir_restore(1, saved);
+    }
+    if (nlive == 0) {
+        t->state = TASK_DONE;
+        t->status = procs[0].status;
+        q->failed++;
+        arena_free(a);
+        return;
+    }
+    struct job_t *job = addjob(cmdline, 1, command, pgid, procs, 1, a);
+    job->queue = q;
+    job->task = k;
+    t->state = TASK_RUN;
+    t->pid = procs[0].pid;
+    q->running++;
+}
+
+/**
+ * queue_flush - -k 时按顺序输出已经结束的任务的输出，遇到没有结束的任务为止
+ */
+static void queue_flush(struct pqueue *q) {
+    while (q->keep && q->flushed < q->ntasks && q->tasks[q->flushed].state == TASK_DONE) {
+        struct ptask *t = &q->tasks[q->flushed++];
+        if (t->fd >= 0) {
+            copy_out(t->fd);
+            close(t->fd);
+            t->fd = -1;
+        }
+    }
+}
+
+/**
+ * queue_fill - 启动任务直到有 maxrun 个任务在运行
+ */
+static void queue_fill(struct pqueue *q) {
+    while (!q->stopped && q->running < q->maxrun && q->next < q->ntasks) {
+        task_start(q, q->next++);
+    }
+    queue_flush(q);
+}
+
+static int queue_done(struct pqueue *q) {
+    return q->running == 0 && (q->stopped || q->next == q->ntasks);
+}
+
+/**
+ * queue_stop - 不再启动新的任务，并向运行中的任务发送 SIGINT
+ */
+static void queue_stop(struct pqueue *q) {
+    q->stopped = 1;
+    for (int i = 0; i < q->next; i++) {
+        if (q->tasks[i].state == TASK_RUN && q->pgid == 0) {
+            kill(-q->tasks[i].pid, SIGINT);
+        }
+    }
+}
+
+static void queue_free(struct pqueue *q) {
+    for (int i = 0; i < q->ntasks; i++) {
+        if (q->tasks[i].state == TASK_RUN) {    // 没有等到结束的任务不再属于这个队列
+            deljob(q->tasks[i].pid);
+        }
+        if (q->tasks[i].fd >= 0) {
+            close(q->tasks[i].fd);
+        }
+    }
+    free(q->tasks);
+    arena_free(q->arena);
+    free(q);
+}
+
+/**
+ * parallel_reaped - 由 reap_children 在 parallel 的任务结束时调用，记录状态并删除作业，
+ * 然后立即启动下一个任务。以 & 运行的队列在最后一个任务结束时输出结果并释放
+ */
+void parallel_reaped(struct job_t *job) {
+    struct pqueue *q = job->queue;
+    struct ptask *t = &q->tasks[job->task];
+
+    t->state = TASK_DONE;
+    t->status = job->procs[0].status;
+    if (t->status != 0) {
+        q->failed++;
+    }
+    q->running--;
+    deljob(job->procs[0].pid);
+    queue_fill(q);
+    if (q->bg && queue_done(q)) {
+        printf("parallel: %d 个任务已完成，%d 个失败\n", q->ntasks, q->failed);
+        queue_free(q);
+        npending--;
+    }
+}
+
+/**
+ * parallel_pending - 返回以 & 运行、还有任务没有完成的队列数，shell 退出之前等待它们完成
+ */
+int parallel_pending(void) {
+    return npending;
+}
+
+/**
+ * queue_wait - 等待并处理下一个事件。shell 中通过 signalfd 等待，
+ * 在管道的子进程中没有 signalfd，直接等待子进程结束。返回 -1 表示没有可以等待的子进程
+ */
+static int queue_wait(void) {
+    siginfo_t info;
+    if (sigfd >= 0) {
+        struct pollfd pfd = { sigfd, POLLIN, 0 };
+        if (poll(&pfd, 1, -1) > 0) {
+            handle_signals();
+        }
+        return 0;
+    }
+    if (waitid(P_ALL, 0, &info, WEXITED | WSTOPPED | WNOWAIT) < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    reap_children();
+    return 0;
+}
+
+static int parallel_usage(void) {
+    fprintf(stderr, "用法: parallel [-j 数量] [-n 数量 | -m] [-k] 命令 [参数 ...] [::: 参数 ...]\n");
+    return 2;
+}
+
+/**
+ * parallel_imp - parallel 内部命令，对每一组参数运行一次命令，同时运行 -j 个（默认为 CPU 数）。
+ * 参数在 ::: 之后给出，没有 ::: 时从标准输入读入，每行一个。命令中的 {} 替换为参数，
+ * 没有 {} 时参数加在命令之后。-n 为每次运行最多使用的参数个数，默认为 1，
+ * -m 表示尽量多，两者都不超过 ARG_MAX。-k 时每个任务的输出先保存下来，按照任务的顺序输出。
+ * 前台运行时状态为失败的任务数（最大为 100），以 & 运行时立即返回
+ */
+int parallel_imp(int argc, char *argv[]) {
+    struct pqueue *q = (struct pqueue *)calloc(1, sizeof(struct pqueue));
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int batch = 1, i, status;
+    char *end;
+
+    q->maxrun = ncpu > 0 ? ncpu : 1;
+    q->brace = -1;
+    q->arena = arena_new(0);
+    for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        const char *opt = argv[i];
+        if (strcmp(opt, "--") == 0) {
+            i++;
+            break;
+        }
+        if (strcmp(opt, "-k") == 0) {
+            q->keep = 1;
+        } else if (strcmp(opt, "-m") == 0) {
+            batch = INT_MAX;
+        } else if ((opt[1] == 'j' || opt[1] == 'n') && (opt[2] != '\0' || i + 1 < argc)) {
+            const char *num = opt[2] != '\0' ? opt + 2 : argv[++i];
+            long v = strtol(num, &end, 10);
+            if (end == num || *end != '\0' || v <= 0 || v > INT_MAX) {
+                fprintf(stderr, "parallel: %s: 需要正整数\n", num);
+                queue_free(q);
+                return 2;
+            }
+            if (opt[1] == 'j') {
+                q->maxrun = v;
+            } else {
+                batch = v;
+            }
+        } else {
+            queue_free(q);
+            return parallel_usage();
+        }
+    }
+    // 命令和参数复制到队列自己的内存池中，以 & 运行时命令的内存池在返回后就会释放
+    q->cmd = (char **)arena_alloc(q->arena, (argc - i + 1) * sizeof(char *));
+    for (; i < argc && strcmp(argv[i], ":::") != 0; i++) {
+        if (q->brace < 0 && strcmp(argv[i], "{}") == 0) {
+            q->brace = q->ncmd;
+        }
+        q->cmd[q->ncmd++] = arena_strdup(q->arena, argv[i]);
+    }
+    if (q->ncmd == 0 || q->brace == 0) {
+        queue_free(q);
+        return parallel_usage();
+    }
+    if (i < argc) {     // ::: 之后的参数
+        q->args = (char **)arena_alloc(q->arena, (argc - i) * sizeof(char *));
+        for (i++; i < argc; i++) {
+            q->args[q->nargs++] = arena_strdup(q->arena, argv[i]);
+        }
+    } else {
+        read_args(q);
+    }
+    make_tasks(q, batch);
+    // 在管道的子进程中，任务留在子进程的进程组中，这样前台的 ctrl + c 可以传递到它们
+    q->pgid = sigfd < 0 ? getpgrp() : 0;
+    q->bg = builtin_bg;
+    if (q->bg) {
+        printf("parallel: %d 个任务在后台运行，同时运行 %d 个\n", q->ntasks, q->maxrun);
+        queue_fill(q);
+        if (queue_done(q)) {
+            printf("parallel: %d 个任务已完成，%d 个失败\n", q->ntasks, q->failed);
+            queue_free(q);
+        } else {
+            npending++;
+        }
+        return 0;
+    }
+    interrupted = 0;
+    queue_fill(q);
+    while (!queue_done(q)) {
+        if (interrupted && !q->stopped) {
+            queue_stop(q);
+        }
+        if (queue_wait() < 0) {
+            break;
+        }
+    }
+    status = q->stopped ? 130 : (q->failed > 100 ? 100 : q->failed);
+    queue_free(q);
+    return status;
+}
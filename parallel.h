@@ -0,0 +1,9 @@
+#ifndef __PARALLEL_H_
+#define __PARALLEL_H_
+
+struct job_t;
+
+void parallel_reaped(struct job_t *job);
+int parallel_pending(void);
+
+#endif
@@ -0,0 +1,571 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cmd.h"
+#include "lexer.h"
+#include "var.h"
+
+/**
+ * 语法分析器的状态，按顺序读取词法分析得到的记号。复合命令没有结束时，
+ * 通过 more 读入下一行，line 和 toks 换成新的一行，记号数组从 scratch 中分配
+ */
+struct parser {
+    struct arena *a;
+    const char *line;
+    struct token *toks;
+    int pos;            // 下一个要读取的记号
+    const char *err;    // 语法错误的信息，NULL 表示没有错误
+    struct arena *scratch;
+    more_fn more;
+    void *ctx;
+};
+
+static char *parseword(struct parser *p, struct token *tok, int *expand);
+static int parseredir(struct parser *p, char **in_file, char **out_file, int *mode, int *expand);
+static int is_assign(struct parser *p, struct token *tok);
+static struct cmd *parseexec(struct parser *p);
+static struct cmd *parsepipe(struct parser *p);
+static int parse_stmt(struct parser *p, struct listcmd *list);
+static struct cmd *parse_list(struct parser *p, const char *msg);
+
+/**
+ * create_pipecmd - 创建一个 pipecmd 对象
+ */
+struct cmd *create_pipecmd(struct arena *a, struct cmd *left, struct cmd *right) {
+    struct pipecmd *pipe_cmd = (struct pipecmd *)arena_alloc(a, sizeof(struct pipecmd));
+    pipe_cmd->type = PIPE;
+    pipe_cmd->fgbg = 0;
+    pipe_cmd->left = left;
+    pipe_cmd->right = right;
+    return (struct cmd *)pipe_cmd;
+}
+
+/**
+ * create_execcmd - 创建一个 execcmd 对象
+ */
+struct cmd *create_execcmd(struct arena *a, int argc, char **argv) {
+    struct execcmd *exec_cmd = (struct execcmd *)arena_alloc(a, sizeof(struct execcmd));
+    exec_cmd->type = EXEC;
+    exec_cmd->fgbg = 0;
+    exec_cmd->argc = argc;
+    exec_cmd->argv = argv;
+    exec_cmd->nassign = 0;
+    exec_cmd->expand = NULL;
+    exec_cmd->assign = NULL;
+    return (struct cmd *)exec_cmd;
+}
+
+/**
+ * create_redircmd - 创建一个 redircmd 对象
+ */
+struct cmd *create_redircmd(struct arena *a, struct cmd *inner_command, int mode,
+                            char *in_file, char *out_file) {
+    struct redircmd *redir_cmd = (struct redircmd *)arena_alloc(a, sizeof(struct redircmd));
+    redir_cmd->type = REDIR;
+    redir_cmd->fgbg = 0;
+    redir_cmd->command = inner_command;
+    redir_cmd->mode = mode;
+    redir_cmd->in_file = in_file;
+    redir_cmd->out_file = out_file;
+    redir_cmd->expand = 0;
+    return (struct cmd *)redir_cmd;
+}
+
+/**
+ * parseword - 返回单词记号 tok 的内容。含有 $ 的单词保留原样（包括引号），
+ * 运行时由 expand 展开，并将 *expand 置为 1；否则去掉引号，*expand 置为 0
+ */
+static char *parseword(struct parser *p, struct token *tok, int *expand) {
+    *expand = (tok->flags & TOK_EXPAND) != 0;
+    if (*expand) {
+        return arena_strndup(p->a, p->line + tok->off, tok->len);
+    }
+    return lex_word(p->a, p->line, tok);
+}
+
+/**
+ * parseredir - 解析一个重定向符号及其后的文件名，出现多次时以最后一次为准，
+ * 缺少文件名时返回 -1。需要展开的文件名记录在 *expand 中
+ */
+static int parseredir(struct parser *p, char **in_file, char **out_file, int *mode, int *expand) {
+    enum tok_kind kind = p->toks[p->pos++].kind;
+    struct token *file = &p->toks[p->pos];
+    int raw;
+    if (file->kind != TOK_WORD) {
+        p->err = "重定向缺少文件名";
+        return -1;
+    }
+    p->pos++;
+    if (kind == TOK_LT) {
+        *in_file = parseword(p, file, &raw);
+        *expand = raw ? *expand | EXPAND_IN : *expand & ~EXPAND_IN;
+    } else {
+        *out_file = parseword(p, file, &raw);
+        *expand = raw ? *expand | EXPAND_OUT : *expand & ~EXPAND_OUT;
+        if (kind == TOK_GTGT) { // 追加
+            *mode = O_APPEND | O_CREAT | O_WRONLY;
+        } else {    // 截断
+            *mode = O_TRUNC | O_CREAT | O_WRONLY;
+        }
+    }
+    return 0;
+}
+
+/**
+ * is_assign - 判断单词记号 tok 是否为变量赋值 name=value，等号之前不能有引号
+ */
+static int is_assign(struct parser *p, struct token *tok) {
+    const char *eq = memchr(p->line + tok->off, '=', tok->len);
+    return eq != NULL && var_isname(p->line + tok->off, eq - (p->line + tok->off));
+}
+
+/**
+ * parseexec - 解析管道中的一段，参数存储到结构体中，若有重定向，
+ * 则再创建一个 redircmd 对象包装它。开头的变量赋值保留原样，运行时展开等号之后的部分：
+ * 所有的单词都是变量赋值时，这一段为赋值命令，否则赋值只作用于运行的命令的环境
+ */
+static struct cmd *parseexec(struct parser *p) {
+    struct token *tok;
+    char *in_file = NULL;
+    char *out_file = NULL;
+    int mode = 0;
+    int argc = 0, nassign = 0;
+    int expand = 0, raw, redir_expand = 0;
+
+    // 先数出参数的个数，重定向之后的单词为文件名，不是参数
+    for (tok = &p->toks[p->pos]; tok->kind != TOK_PIPE && tok->kind != TOK_AMP &&
+         tok->kind != TOK_SEMI && tok->kind != TOK_END; tok++) {
+        if (tok->kind == TOK_WORD) {
+            if (argc++ == nassign && is_assign(p, tok)) {
+                nassign++;
+            }
+            expand |= tok->flags & TOK_EXPAND;
+        } else if (tok[1].kind == TOK_WORD) {
+            tok++;
+        }
+    }
+    char **argv = (char **)arena_alloc(p->a, (argc + 1) * sizeof(char *));
+    unsigned char *flags = NULL;
+    if (expand || nassign) {
+        flags = (unsigned char *)arena_alloc(p->a, argc + 1);
+    }
+    argc = 0;
+    while (1) {
+        tok = &p->toks[p->pos];
+        if (tok->kind == TOK_WORD) {
+            if (argc < nassign) {
+                argv[argc] = arena_strndup(p->a, p->line + tok->off, tok->len);
+                raw = 1;
+            } else {
+                argv[argc] = parseword(p, tok, &raw);
+            }
+            if (flags) {
+                flags[argc] = raw;
+            }
+            argc++;
+            p->pos++;
+        } else if (tok->kind == TOK_LT || tok->kind == TOK_GT || tok->kind == TOK_GTGT) {
+            if (parseredir(p, &in_file, &out_file, &mode, &redir_expand) < 0) {
+                return NULL;
+            }
+        } else {
+            break;
+        }
+    }
+    argv[argc] = NULL;
+    if (argc == 0) {
+        p->err = "缺少命令";
+        return NULL;
+    }
+
+    struct cmd *command = create_execcmd(p->a, argc, argv);
+    ((struct execcmd *)command)->nassign = nassign;
+    ((struct execcmd *)command)->expand = flags;
+    if (in_file || out_file) {    // 存在重定向
+        command = create_redircmd(p->a, command, mode, in_file, out_file);
+        ((struct redircmd *)command)->expand = redir_expand;
+    }
+    return command;
+}
+
+/**
+ * parsepipe - 解析管道中的一段，若之后为 |，则说明有管道，
+ * 继续解析剩余的部分，作为 pipecmd 的右子树
+ */
+static struct cmd *parsepipe(struct parser *p) {
+    struct cmd *command = parseexec(p);
+    if (command == NULL) {
+        return NULL;
+    }
+    if (p->toks[p->pos].kind == TOK_PIPE) { // 找到 '|'，为管道
+        p->pos++;
+        struct cmd *right = parsepipe(p);
+        if (right == NULL) {
+            return NULL;
+        }
+        command = create_pipecmd(p->a, command, right);
+    }
+    return command;
+}
+
+/**
+ * create_listcmd - 创建一个空的 listcmd 对象
+ */
+struct listcmd *create_listcmd(struct arena *a) {
+    struct listcmd *list = (struct listcmd *)arena_alloc(a, sizeof(struct listcmd));
+    list->type = LIST;
+    list->fgbg = 0;
+    list->n = 0;
+    list->cap = 0;
+    list->cmds = NULL;
+    list->cmdlines = NULL;
+    return list;
+}
+
+/**
+ * list_add - 在 list 的末尾加入一条命令，简单命令的 cmdline 为它的命令行，
+ * 复合命令为 NULL。数组不够时从 a 中分配加倍的数组
+ */
+void list_add(struct arena *a, struct listcmd *list, struct cmd *command, char *cmdline) {
+    if (list->n == list->cap) {
+        int cap = list->cap ? list->cap * 2 : 4;
+        struct cmd **cmds = (struct cmd **)arena_alloc(a, cap * sizeof(struct cmd *));
+        char **cmdlines = (char **)arena_alloc(a, cap * sizeof(char *));
+        if (list->n > 0) {
+            memcpy(cmds, list->cmds, list->n * sizeof(struct cmd *));
+            memcpy(cmdlines, list->cmdlines, list->n * sizeof(char *));
+        }
+        list->cmds = cmds;
+        list->cmdlines = cmdlines;
+        list->cap = cap;
+    }
+    list->cmds[list->n] = command;
+    list->cmdlines[list->n] = cmdline;
+    list->n++;
+}
+
+/**
+ * create_ifcmd - 创建一个 ifcmd 对象
+ */
+struct cmd *create_ifcmd(struct arena *a, struct cmd *cond, struct cmd *then, struct cmd *els) {
+    struct ifcmd *if_cmd = (struct ifcmd *)arena_alloc(a, sizeof(struct ifcmd));
+    if_cmd->type = IF;
+    if_cmd->fgbg = 0;
+    if_cmd->cond = cond;
+    if_cmd->then = then;
+    if_cmd->els = els;
+    return (struct cmd *)if_cmd;
+}
+
+/**
+ * create_whilecmd - 创建一个 whilecmd 对象
+ */
+struct cmd *create_whilecmd(struct arena *a, struct cmd *cond, struct cmd *body) {
+    struct whilecmd *while_cmd = (struct whilecmd *)arena_alloc(a, sizeof(struct whilecmd));
+    while_cmd->type = WHILE;
+    while_cmd->fgbg = 0;
+    while_cmd->cond = cond;
+    while_cmd->body = body;
+    return (struct cmd *)while_cmd;
+}
+
+/**
+ * create_forcmd - 创建一个 forcmd 对象
+ */
+struct cmd *create_forcmd(struct arena *a, char *name, struct execcmd *words, struct cmd *body) {
+    struct forcmd *for_cmd = (struct forcmd *)arena_alloc(a, sizeof(struct forcmd));
+    for_cmd->type = FOR;
+    for_cmd->fgbg = 0;
+    for_cmd->name = name;
+    for_cmd->words = words;
+    for_cmd->body = body;
+    return (struct cmd *)for_cmd;
+}
+
+/**
+ * is_keyword - 判断 tok 是否为保留字 kw，只有不带引号的单词才可能是保留字
+ */
+static int is_keyword(struct parser *p, struct token *tok, const char *kw) {
+    size_t len = strlen(kw);
+    return tok->kind == TOK_WORD && tok->flags == 0 && (size_t)tok->len == len &&
+           memcmp(p->line + tok->off, kw, len) == 0;
+}
+
+/**
+ * is_terminator - 判断 tok 是否为结束复合命令的一部分的保留字
+ */
+static int is_terminator(struct parser *p, struct token *tok) {
+    static const char *const words[] = { "then", "elif", "else", "fi", "do", "done" };
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+        if (is_keyword(p, tok, words[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * unexpected - 记号 tok 出现在不应出现的位置
+ */
+static void unexpected(struct parser *p, struct token *tok) {
+    static char buf[64];    // 错误信息在返回之后才输出
+    snprintf(buf, sizeof(buf), "意外的 %.*s", tok->len, p->line + tok->off);
+    p->err = buf;
+}
+
+/**
+ * next_line - 复合命令没有结束，读入下一行并扫描得到记号。
+ * 没有更多输入时以 msg 为错误信息，返回 -1
+ */
+static int next_line(struct parser *p, const char *msg) {
+    const char *line = p->more != NULL ? p->more(p->ctx) : NULL;
+    if (line == NULL) {
+        p->err = msg;
+        return -1;
+    }
+    p->line = line;
+    p->pos = 0;
+    return lex(p->scratch, line, &p->toks, &p->err) < 0 ? -1 : 0;
+}
+
+/**
+ * skip_separators - 跳过分号和行尾，停在下一条命令的开头
+ */
+static int skip_separators(struct parser *p, const char *msg) {
+    while (1) {
+        enum tok_kind kind = p->toks[p->pos].kind;
+        if (kind == TOK_SEMI) {
+            p->pos++;
+        } else if (kind != TOK_END) {
+            return 0;
+        } else if (next_line(p, msg) < 0) {
+            return -1;
+        }
+    }
+}
+
+/**
+ * expect - 当前记号应为保留字 kw，是则跳过它，否则设置错误信息并返回 -1
+ */
+static int expect(struct parser *p, const char *kw) {
+    if (!is_keyword(p, &p->toks[p->pos], kw)) {
+        unexpected(p, &p->toks[p->pos]);
+        return -1;
+    }
+    p->pos++;
+    return 0;
+}
+
+/**
+ * parse_if - 解析 if 或 elif 之后的部分，直到 fi。elif 解析为 else 中嵌套的 if，
+ * 与外层共用同一个 fi
+ */
+static struct cmd *parse_if(struct parser *p) {
+    struct cmd *cond, *then, *els = NULL;
+
+    if ((cond = parse_list(p, "缺少 then")) == NULL || expect(p, "then") < 0 ||
+        (then = parse_list(p, "缺少 fi")) == NULL) {
+        return NULL;
+    }
+    if (is_keyword(p, &p->toks[p->pos], "elif")) {
+        p->pos++;
+        if ((els = parse_if(p)) == NULL) {
+            return NULL;
+        }
+    } else {
+        if (is_keyword(p, &p->toks[p->pos], "else")) {
+            p->pos++;
+            if ((els = parse_list(p, "缺少 fi")) == NULL) {
+                return NULL;
+            }
+        }
+        if (expect(p, "fi") < 0) {
+            return NULL;
+        }
+    }
+    return create_ifcmd(p->a, cond, then, els);
+}
+
+/**
+ * parse_while - 解析 while 之后的部分，直到 done
+ */
+static struct cmd *parse_while(struct parser *p) {
+    struct cmd *cond, *body;
+
+    if ((cond = parse_list(p, "缺少 do")) == NULL || expect(p, "do") < 0 ||
+        (body = parse_list(p, "缺少 done")) == NULL || expect(p, "done") < 0) {
+        return NULL;
+    }
+    return create_whilecmd(p->a, cond, body);
+}
+
+/**
+ * parse_for - 解析 for 之后的部分：变量名，可选的 in 和单词，之后为 do ... done。
+ * 单词与命令的参数一样，含有 $ 的保留原样，每次运行循环时展开
+ */
+static struct cmd *parse_for(struct parser *p) {
+    struct token *tok = &p->toks[p->pos];
+    struct execcmd *words = NULL;
+    struct cmd *body;
+    int argc = 0, expand = 0, raw;
+
+    if (tok->kind != TOK_WORD || tok->flags != 0 || !var_isname(p->line + tok->off, tok->len)) {
+        p->err = "for 之后应为变量名";
+        return NULL;
+    }
+    char *name = arena_strndup(p->a, p->line + tok->off, tok->len);
+    p->pos++;
+    if (is_keyword(p, &p->toks[p->pos], "in")) {
+        p->pos++;
+        for (tok = &p->toks[p->pos]; tok->kind == TOK_WORD; tok++) {
+            argc++;
+            expand |= tok->flags & TOK_EXPAND;
+        }
+        if (tok->kind != TOK_SEMI && tok->kind != TOK_END) {
+            unexpected(p, tok);
+            return NULL;
+        }
+        char **argv = (char **)arena_alloc(p->a, (argc + 1) * sizeof(char *));
+        unsigned char *flags = expand ? (unsigned char *)arena_alloc(p->a, argc + 1) : NULL;
+        for (int i = 0; i < argc; i++) {
+            argv[i] = parseword(p, &p->toks[p->pos++], &raw);
+            if (flags) {
+                flags[i] = raw;
+            }
+        }
+        argv[argc] = NULL;
+        words = (struct execcmd *)create_execcmd(p->a, argc, argv);
+        words->expand = flags;
+    }
+    if (skip_separators(p, "缺少 do") < 0 || expect(p, "do") < 0 ||
+        (body = parse_list(p, "缺少 done")) == NULL || expect(p, "done") < 0) {
+        return NULL;
+    }
+    return create_forcmd(p->a, name, words, body);
+}
+
+/**
+ * parse_simple - 解析一条简单命令（管道），命令行为从第一个记号到 & 为止的原文
+ */
+static int parse_simple(struct parser *p, struct listcmd *list) {
+    int start = p->toks[p->pos].off;
+    struct cmd *command = parsepipe(p);
+    if (command == NULL) {
+        return -1;
+    }
+    if (p->toks[p->pos].kind == TOK_AMP) { // 判断为前台运行还是后台运行
+        command->fgbg = 1;
+        p->pos++;
+    }
+    struct token *last = &p->toks[p->pos - 1];
+    list_add(p->a, list, command, arena_strndup(p->a, p->line + start, last->off + last->len - start));
+    return 0;
+}
+
+/**
+ * parse_stmt - 解析一条命令并加入 list，以 if、while 或 for 开头的为复合命令。
+ * 复合命令之后只能是分号、行尾或者外层的保留字，不支持管道、重定向和后台运行
+ */
+static int parse_stmt(struct parser *p, struct listcmd *list) {
+    struct token *tok = &p->toks[p->pos];
+    struct cmd *command;
+
+    if (is_keyword(p, tok, "if")) {
+        p->pos++;
+        command = parse_if(p);
+    } else if (is_keyword(p, tok, "while")) {
+        p->pos++;
+        command = parse_while(p);
+    } else if (is_keyword(p, tok, "for")) {
+        p->pos++;
+        command = parse_for(p);
+    } else {
+        return parse_simple(p, list);
+    }
+    if (command == NULL) {
+        return -1;
+    }
+    tok = &p->toks[p->pos];
+    if (tok->kind != TOK_SEMI && tok->kind != TOK_END && !is_terminator(p, tok)) {
+        p->err = "复合命令之后不能使用管道、重定向或 &";
+        return -1;
+    }
+    list_add(p->a, list, command, NULL);
+    return 0;
+}
+
+/**
+ * parse_list - 解析一串命令，直到遇到 then、do、fi 等保留字为止，可以跨越多行。
+ * 没有更多输入时以 msg 为错误信息，一条命令也没有时为语法错误
+ */
+static struct cmd *parse_list(struct parser *p, const char *msg) {
+    struct listcmd *list = create_listcmd(p->a);
+
+    while (1) {
+        if (skip_separators(p, msg) < 0) {
+            return NULL;
+        }
+        if (is_terminator(p, &p->toks[p->pos])) {
+            break;
+        }
+        if (parse_stmt(p, list) < 0) {
+            return NULL;
+        }
+    }
+    if (list->n == 0) {
+        unexpected(p, &p->toks[p->pos]);
+        return NULL;
+    }
+    return (struct cmd *)list;
+}
+
+/**
+ * parsecmd - 解析输入的命令：先扫描一遍命令行得到记号，再由记号构造命令树。
+ * 空命令返回 NULL，语法错误时输出错误信息并返回 NULL
+ */
+struct cmd *parsecmd(struct arena *a, const char *cmd, more_fn more, void *ctx) {
+    const char *err = NULL;
+    struct cmd *command = parseline(a, a, cmd, more, ctx, &err);
+    if (err != NULL) {
+        fprintf(stderr, "myshell: 语法错误: %s\n", err);
+    }
+    return command;
+}
+
+/**
+ * parseline - 解析一行命令，命令树从 a 中分配，记号数组从 scratch 中分配，
+ * 解析之后就不再需要 scratch。一行中可以有多条用分号分隔的命令，命令以 & 结尾时在后台运行；
+ * 复合命令在这一行没有结束时，通过 more 读入之后的行，这时 cmd 可能已经失效。
+ * 只有一条简单命令时直接返回它的命令树，否则返回 LIST。
+ * 空命令返回 NULL，语法错误时返回 NULL 并通过 err 返回错误信息
+ */
+struct cmd *parseline(struct arena *a, struct arena *scratch, const char *cmd,
+                      more_fn more, void *ctx, const char **err) {
+    struct parser p = { a, cmd, NULL, 0, NULL, scratch, more, ctx };
+    struct listcmd *list = create_listcmd(a);
+
+    if (lex(scratch, cmd, &p.toks, &p.err) == 0) {   // 空命令，返回 NULL
+        return NULL;
+    }
+    while (p.err == NULL && p.toks[p.pos].kind != TOK_END) {
+        if (p.toks[p.pos].kind == TOK_SEMI) {
+            p.pos++;
+        } else if (is_terminator(&p, &p.toks[p.pos])) {
+            unexpected(&p, &p.toks[p.pos]);
+        } else {
+            parse_stmt(&p, list);
+        }
+    }
+    if (p.err != NULL) {
+        *err = p.err;
+        return NULL;
+    }
+    if (list->n == 0) {
+        return NULL;
+    }
+    if (list->n == 1 && list->cmdlines[0] != NULL) {
+        return list->cmds[0];
+    }
+    return (struct cmd *)list;
+}
@@ -0,0 +1,282 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "built_in_command.h"
+#include "pipeio.h"
+
+#define MOVE_CHUNK (1 << 20)    // 每次 splice 请求的字节数，实际移动的量受管道容量限制
+#define COPY_CHUNK 65536        // 不能使用 splice 时，经过用户空间复制的缓冲区大小
+#define MAX_OUTS 16
+
+extern mode_t mode;
+
+/*
+ * scat 和 stee 是管道中搬运数据的内部命令，数据只在内核中移动：
+ * 文件到管道、管道到文件使用 splice(2)，复制管道中的数据使用 tee(2)。
+ * 两端都不是管道、或者文件系统不支持时退回到 read/write
+ */
+
+/**
+ * pipe_max_size - 返回系统允许的管道最大容量（/proc/sys/fs/pipe-max-size），读取失败时返回 1 MiB
+ */
+long pipe_max_size(void) {
+    long size = 1 << 20;
+    FILE *fp = fopen("/proc/sys/fs/pipe-max-size", "r");
+    if (fp != NULL) {
+        if (fscanf(fp, "%ld", &size) != 1) {
+            size = 1 << 20;
+        }
+        fclose(fp);
+    }
+    return size;
+}
+
+static int is_pipe(int fd) {
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+/**
+ * write_all - 将 buf 中的 n 个字节全部写入 fd，出错时返回 -1
+ */
+static int write_all(int fd, const char *buf, size_t n) {
+    while (n > 0) {
+        ssize_t w = write(fd, buf, n);
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += w;
+        n -= w;
+    }
+    return 0;
+}
+
+/**
+ * copy_fds - 经过用户空间从 in 读入直到文件末尾，写入 outs 中的每一个描述符
+ */
+static int copy_fds(int in, const int *outs, int nout) {
+    static char buf[COPY_CHUNK];
+    ssize_t n;
+    while ((n = read(in, buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        for (int i = 0; i < nout; i++) {
+            if (write_all(outs[i], buf, n) < 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * move_all - 用 splice 从 in 向 out 移动正好 n 个字节，in 或 out 至少一个为管道
+ */
+static int move_all(int in, int out, size_t n) {
+    while (n > 0) {
+        ssize_t m = splice(in, NULL, out, NULL, n, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (m <= 0) {
+            if (m < 0 && errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        n -= m;
+    }
+    return 0;
+}
+
+/**
+ * cat_fd - 将 in 的内容全部写到标准输出。标准输出为管道，或者 in 为管道时使用 splice；
+ * 否则使用 sendfile，它们都不支持时（如终端）退回到 read/write。
+ * 只有还没有移动任何数据时才会退回，返回 -1 表示出错
+ */
+static int cat_fd(int in) {
+    int out = 1;
+    int use_splice = is_pipe(1) || is_pipe(in);
+    size_t total = 0;
+    ssize_t m;
+
+    while (1) {
+        if (use_splice) {
+            m = splice(in, NULL, 1, NULL, MOVE_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+        } else {
+            m = sendfile(1, in, NULL, MOVE_CHUNK);
+        }
+        if (m == 0) {
+            return 0;
+        }
+        if (m < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (total == 0 && (errno == EINVAL || errno == ENOSYS)) {
+                return copy_fds(in, &out, 1);
+            }
+            return -1;
+        }
+        total += m;
+    }
+}
+
+/**
+ * scat_imp - scat 内部命令，与 cat 相同，依次输出每个文件的内容，没有参数或者参数为 - 时
+ * 输出标准输入。用于管道中文件到管道、管道到文件的一段，数据不经过用户空间
+ */
+int scat_imp(int argc, char *argv[]) {
+    int ret = 0;
+    fflush(stdout);
+    if (argc < 2) {
+        return cat_fd(0) < 0 ? (perror("scat"), 1) : 0;
+    }
+    for (int i = 1; i < argc; i++) {
+        int fd = strcmp(argv[i], "-") == 0 ? 0 : open(argv[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            fprintf(stderr, "scat: %s: %s\n", argv[i], strerror(errno));
+            ret = 1;
+            continue;
+        }
+        if (cat_fd(fd) < 0) {
+            fprintf(stderr, "scat: %s: %s\n", argv[i], strerror(errno));
+            ret = 1;
+        }
+        if (fd != 0) {
+            close(fd);
+        }
+    }
+    return ret;
+}
+
+/**
+ * tee_fds - 将标准输入（管道）中的数据复制到 outs 中的每一个描述符。
+ * 第一个输出为管道时由 tee 直接复制；其余的输出先 tee 到一个空的中间管道再 splice 出去；
+ * 最后一个输出用 splice 取走标准输入中同样多的字节。出错时返回 -1
+ */
+static int tee_fds(const int *outs, int nout) {
+    int tmp[MAX_OUTS][2];
+    int ret = -1;
+    long size = fcntl(0, F_GETPIPE_SZ);
+    size_t cap = MOVE_CHUNK;    // 每一轮最多复制的字节数，不超过任何一个中间管道的容量
+
+    for (int i = 0; i < nout; i++) {
+        tmp[i][0] = tmp[i][1] = -1;
+    }
+    for (int i = 0; i < nout - 1; i++) {
+        if (i == 0 && is_pipe(outs[0])) {
+            continue;
+        }
+        if (pipe2(tmp[i], O_CLOEXEC) < 0) {
+            goto out;
+        }
+        if (size > 0) {
+            fcntl(tmp[i][1], F_SETPIPE_SZ, size);
+        }
+        long c = fcntl(tmp[i][1], F_GETPIPE_SZ);
+        if (c > 0 && (size_t)c < cap) {
+            cap = c;
+        }
+    }
+    while (1) {
+        size_t n = cap;
+        for (int i = 0; i < nout - 1; i++) {
+            int dst = tmp[i][1] >= 0 ? tmp[i][1] : outs[i];
+            ssize_t m = tee(0, dst, n, 0);
+            if (m < 0 && errno == EINTR) {
+                i--;
+                continue;
+            }
+            // 中间管道是空的，之后的 tee 一定能复制与第一个输出相同的字节数
+            if (m < 0 || (i > 0 && (size_t)m != n)) {
+                goto out;
+            }
+            if (m == 0) {   // 标准输入的写端都已关闭
+                ret = 0;
+                goto out;
+            }
+            n = m;
+            if (dst != outs[i] && move_all(tmp[i][0], outs[i], n) < 0) {
+                goto out;
+            }
+        }
+        if (nout > 1) {
+            if (move_all(0, outs[nout - 1], n) < 0) {
+                goto out;
+            }
+            continue;
+        }
+        ssize_t m = splice(0, NULL, outs[0], NULL, n, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (m == 0) {
+            ret = 0;
+            goto out;
+        }
+        if (m < 0 && errno != EINTR) {
+            goto out;
+        }
+    }
+out:
+    for (int i = 0; i < nout; i++) {
+        if (tmp[i][0] >= 0) {
+            close(tmp[i][0]);
+            close(tmp[i][1]);
+        }
+    }
+    return ret;
+}
+
+/**
+ * stee_imp - stee 内部命令，与 tee 相同，将标准输入复制到标准输出和每个文件中，-a 表示追加。
+ * 标准输入为管道时用 tee 和 splice 复制，数据不经过用户空间；-a 时只能经过用户空间复制
+ */
+int stee_imp(int argc, char *argv[]) {
+    int outs[MAX_OUTS];
+    int nout = 0, ret = 0, i = 1;
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+    if (argc > 1 && strcmp(argv[1], "-a") == 0) {
+        flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC;
+        i++;
+    }
+    if (argc - i >= MAX_OUTS) {
+        fprintf(stderr, "stee: 最多 %d 个文件\n", MAX_OUTS - 1);
+        return 1;
+    }
+    fflush(stdout);
+    outs[nout++] = 1;
+    for (; i < argc; i++) {
+        int fd = open(argv[i], flags, 0666 & ~mode);
+        if (fd < 0) {
+            fprintf(stderr, "stee: %s: %s\n", argv[i], strerror(errno));
+            ret = 1;
+            continue;
+        }
+        outs[nout++] = fd;
+    }
+    // splice 不能写入终端和以 O_APPEND 打开的文件，这时和标准输入不是管道时一样经过用户空间复制
+    int spliceable = is_pipe(0);
+    for (int j = 0; j < nout; j++) {
+        if (isatty(outs[j]) || (fcntl(outs[j], F_GETFL) & O_APPEND)) {
+            spliceable = 0;
+        }
+    }
+    if ((spliceable ? tee_fds(outs, nout) : copy_fds(0, outs, nout)) < 0) {
+        perror("stee");
+        ret = 1;
+    }
+    for (int j = 1; j < nout; j++) {
+        close(outs[j]);
+    }
+    return ret;
+}
@@ -0,0 +1,6 @@
+#ifndef __PIPEIO_H_
+#define __PIPEIO_H_
+
+long pipe_max_size(void);
+
+#endif
@@ -0,0 +1,170 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "reader.h"
+
+#define BLOCK_SIZE 65536
+
+/**
+ * reader_init - 初始化从描述符 fd 按块读入的 reader
+ */
+void reader_init(struct reader *r, int fd) {
+    r->fd = fd;
+    r->cap = BLOCK_SIZE;
+    r->buf = (char *)malloc(r->cap);
+    r->start = r->end = r->scan = 0;
+    r->eof = 0;
+    r->map = NULL;
+    r->maplen = r->mappos = 0;
+}
+
+/**
+ * reader_open_file - 打开脚本文件并映射到内存中，失败时返回 -1 并设置 errno
+ */
+int reader_open_file(struct reader *r, const char *path) {
+    struct stat st;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    reader_init(r, fd);
+    if (st.st_size > 0 && S_ISREG(st.st_mode)) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            r->map = map;
+            r->maplen = st.st_size;
+            close(fd);
+            r->fd = -1;
+        }
+    }
+    // 不能映射的文件（如管道）按块读入
+    return 0;
+}
+
+/**
+ * ensure - 保证缓冲区末尾至少还有 need 个字节的空间，
+ * 先将未返回的数据移动到开头，空间仍然不够时将缓冲区加倍
+ */
+static void ensure(struct reader *r, size_t need) {
+    if (r->start > 0) {
+        memmove(r->buf, r->buf + r->start, r->end - r->start);
+        r->end -= r->start;
+        r->scan -= r->start;
+        r->start = 0;
+    }
+    while (r->cap - r->end < need) {
+        r->cap *= 2;
+        r->buf = (char *)realloc(r->buf, r->cap);
+    }
+}
+
+/**
+ * getline_map - 从映射的文件中取出一行，复制到缓冲区中并以 '\0' 结尾
+ */
+static char *getline_map(struct reader *r, size_t *len) {
+    if (r->mappos >= r->maplen) {
+        return NULL;
+    }
+    const char *line = r->map + r->mappos;
+    const char *nl = memchr(line, '\n', r->maplen - r->mappos);
+    size_t n = nl ? (size_t)(nl - line) : r->maplen - r->mappos;
+    r->mappos += n + (nl != NULL);
+    r->start = r->end = r->scan = 0;
+    ensure(r, n + 1);
+    memcpy(r->buf, line, n);
+    r->buf[n] = '\0';
+    *len = n;
+    return r->buf;
+}
+
+/**
+ * reader_getline - 读入一行，返回以 '\0' 结尾的行（不包含换行符），长度通过 len 返回，
+ * 到达文件末尾时返回 NULL。返回的字符串在下一次调用之前有效
+ */
+char *reader_getline(struct reader *r, size_t *len) {
+    char *nl;
+
+    if (r->map) {
+        return getline_map(r, len);
+    }
+    while (1) {
+        // 只在新读入的部分中查找换行符
+        if ((nl = memchr(r->buf + r->scan, '\n', r->end - r->scan)) != NULL) {
+            char *line = r->buf + r->start;
+            *nl = '\0';
+            *len = nl - line;
+            r->start = r->scan = nl + 1 - r->buf;
+            return line;
+        }
+        r->scan = r->end;
+        if (r->eof) {
+            if (r->start == r->end) {
+                return NULL;
+            }
+            ensure(r, 1);   // 最后一行没有换行符
+            r->buf[r->end] = '\0';
+            *len = r->end - r->start;
+            r->start = r->scan = r->end;
+            return r->buf;
+        }
+        reader_fill(r);
+    }
+}
+
+/**
+ * reader_has_line - 判断 reader_getline 是否可以不读入数据就返回，
+ * 即缓冲区中已经有完整的一行，或者已经到达文件末尾
+ */
+int reader_has_line(struct reader *r) {
+    if (r->map || r->eof) {
+        return 1;
+    }
+    if (memchr(r->buf + r->scan, '\n', r->end - r->scan) != NULL) {
+        return 1;
+    }
+    r->scan = r->end;
+    return 0;
+}
+
+/**
+ * reader_fill - 调用一次 read 读入数据，返回读入的字节数，到达文件末尾时返回 0
+ */
+ssize_t reader_fill(struct reader *r) {
+    ssize_t n;
+    ensure(r, BLOCK_SIZE / 2);
+    while ((n = read(r->fd, r->buf + r->end, r->cap - r->end)) < 0 && errno == EINTR) {
+    }
+    if (n <= 0) {
+        r->eof = 1;
+        return 0;
+    }
+    r->end += n;
+    return n;
+}
+
+/**
+ * reader_close - 关闭描述符，释放缓冲区和映射的文件
+ */
+void reader_close(struct reader *r) {
+    if (r->map) {
+        munmap((void *)r->map, r->maplen);
+        r->map = NULL;
+    }
+    if (r->fd >= 0) {
+        close(r->fd);
+        r->fd = -1;
+    }
+    free(r->buf);
+    r->buf = NULL;
+}
@@ -0,0 +1,31 @@
+#ifndef __READER_H_
+#define __READER_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * 按行读入命令的缓冲区。交互模式下从 fd 中按块读入，缓冲区可以增长，
+ * 因此行的长度没有限制；脚本模式下将整个文件映射到内存中
+ */
+struct reader {
+    int fd;
+    char *buf;          // 读入的数据，buf[start, end) 为尚未返回的部分
+    size_t start;
+    size_t end;
+    size_t scan;        // buf[start, scan) 中已经确认没有换行符
+    size_t cap;
+    int eof;
+    const char *map;    // 脚本模式下映射的文件，NULL 表示交互模式
+    size_t maplen;
+    size_t mappos;
+};
+
+void reader_init(struct reader *r, int fd);
+int reader_open_file(struct reader *r, const char *path);
+char *reader_getline(struct reader *r, size_t *len);
+int reader_has_line(struct reader *r);
+ssize_t reader_fill(struct reader *r);
+void reader_close(struct reader *r);
+
+#endif
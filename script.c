@@ -0,0 +1,500 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "script.h"
+#include "cmd.h"
+#include "reader.h"
+#include "stats.h"
+#include "trace.h"
+
+/*
+ * 设置了 MYSHELL_CACHE 时，编译的结果写入该目录下的缓存文件，文件名由脚本的绝对路径决定。
+ * 缓存文件的内容为 cache_header 和之后的每一条命令，命令的格式为：
+ *   u32 行号，str 命令行，node 命令树
+ * 其中 str 为 u32 长度、内容和 '\0'，node 为 u8 类型、u8 fgbg 和之后的：
+ *   EXEC   u32 argc，u32 nassign，u8 是否有 expand，有时为 argc 个 u8，之后为 argc 个 str
+ *   PIPE   左右两个 node
+ *   REDIR  i32 mode，u8 标志（1 为有输入文件，2 为有输出文件），u8 expand，
+ *          存在的文件名 str，内部的 node
+ *   LIST   u32 n，之后 n 项，每一项为 u8 是否有命令行，有时为 str，之后为 node
+ *   IF     条件和 then 两个 node，u8 是否有 else，有时为 node
+ *   WHILE  条件和循环体两个 node
+ *   FOR    str 变量名，u8 是否有 in，有时为 EXEC 格式的单词（不含类型），之后为循环体 node
+ * 缓存只在同一台机器上使用，整数按本机的字节序存储
+ */
+#define CACHE_MAGIC "MYSHC03"
+
+struct cache_header {
+    char magic[8];
+    int64_t mtime_sec;      // 脚本的修改时间和大小
+    int64_t mtime_nsec;
+    int64_t size;
+    uint64_t hash;          // 脚本内容的哈希值
+    uint32_t ncmds;
+    uint32_t pad;
+};
+
+/**
+ * 读取缓存时的位置，任何越界都使 bad 置位，整个缓存作废
+ */
+struct cursor {
+    char *p;
+    char *end;
+    int bad;
+};
+
+/**
+ * fnv64 - 计算 len 字节的 FNV-1a 哈希值
+ */
+static uint64_t fnv64(const char *data, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/**
+ * cache_path - 缓存文件的路径，没有设置 MYSHELL_CACHE 时返回 -1
+ */
+static int cache_path(const char *path, char *buf, size_t size) {
+    char real[PATH_MAX];
+    const char *dir = getenv("MYSHELL_CACHE");
+    if (dir == NULL || *dir == '\0') {
+        return -1;
+    }
+    if (realpath(path, real) == NULL) {
+        return -1;
+    }
+    snprintf(buf, size, "%s/%016llx.cache", dir, (unsigned long long)fnv64(real, strlen(real)));
+    return 0;
+}
+
+/**
+ * add_cmd - 将一条命令加入脚本，数组不够时加倍
+ */
+static void add_cmd(struct script *s, int lineno, char *cmdline, struct cmd *command) {
+    if (s->ncmds == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 64;
+        s->cmds = (struct script_cmd *)realloc(s->cmds, s->cap * sizeof(struct script_cmd));
+    }
+    s->cmds[s->ncmds].lineno = lineno;
+    s->cmds[s->ncmds].cmdline = cmdline;
+    s->cmds[s->ncmds].command = command;
+    s->ncmds++;
+}
+
+static void put_u32(FILE *fp, uint32_t v) {
+    fwrite(&v, sizeof(v), 1, fp);
+}
+
+static void put_str(FILE *fp, const char *str) {
+    uint32_t len = strlen(str);
+    put_u32(fp, len);
+    fwrite(str, 1, len + 1, fp);
+}
+
+/**
+ * put_exec - 写出 EXEC 结点的内容
+ */
+static void put_exec(FILE *fp, struct execcmd *exec_cmd) {
+    put_u32(fp, exec_cmd->argc);
+    put_u32(fp, exec_cmd->nassign);
+    fputc(exec_cmd->expand != NULL, fp);
+    if (exec_cmd->expand) {
+        fwrite(exec_cmd->expand, 1, exec_cmd->argc, fp);
+    }
+    for (int i = 0; i < exec_cmd->argc; i++) {
+        put_str(fp, exec_cmd->argv[i]);
+    }
+}
+
+/**
+ * put_node - 按前序写出命令树
+ */
+static void put_node(FILE *fp, struct cmd *command) {
+    fputc(command->type, fp);
+    fputc(command->fgbg, fp);
+    switch (command->type) {
+        case EXEC:
+            put_exec(fp, (struct execcmd *)command);
+            break;
+        case PIPE:
+            put_node(fp, ((struct pipecmd *)command)->left);
+            put_node(fp, ((struct pipecmd *)command)->right);
+            break;
+        case REDIR: {
+            struct redircmd *redir_cmd = (struct redircmd *)command;
+            put_u32(fp, redir_cmd->mode);
+            fputc((redir_cmd->in_file != NULL) | (redir_cmd->out_file != NULL) << 1, fp);
+            fputc(redir_cmd->expand, fp);
+            if (redir_cmd->in_file) {
+                put_str(fp, redir_cmd->in_file);
+            }
+            if (redir_cmd->out_file) {
+                put_str(fp, redir_cmd->out_file);
+            }
+            put_node(fp, redir_cmd->command);
+            break;
+        }
+        case LIST: {
+            struct listcmd *list = (struct listcmd *)command;
+            put_u32(fp, list->n);
+            for (int i = 0; i < list->n; i++) {
+                fputc(list->cmdlines[i] != NULL, fp);
+                if (list->cmdlines[i]) {
+                    put_str(fp, list->cmdlines[i]);
+                }
+                put_node(fp, list->cmds[i]);
+            }
+            break;
+        }
+        case IF: {
+            struct ifcmd *if_cmd = (struct ifcmd *)command;
+            put_node(fp, if_cmd->cond);
+            put_node(fp, if_cmd->then);
+            fputc(if_cmd->els != NULL, fp);
+            if (if_cmd->els) {
+                put_node(fp, if_cmd->els);
+            }
+            break;
+        }
+        case WHILE:
+            put_node(fp, ((struct whilecmd *)command)->cond);
+            put_node(fp, ((struct whilecmd *)command)->body);
+            break;
+        case FOR: {
+            struct forcmd *for_cmd = (struct forcmd *)command;
+            put_str(fp, for_cmd->name);
+            fputc(for_cmd->words != NULL, fp);
+            if (for_cmd->words) {
+                put_exec(fp, for_cmd->words);
+            }
+            put_node(fp, for_cmd->body);
+            break;
+        }
+    }
+}
+
+/**
+ * cache_write - 将编译的结果写入临时文件，再重命名为缓存文件，
+ * 同时运行的多个 shell 不会读到写了一半的缓存。失败时不影响脚本的运行
+ */
+static void cache_write(struct script *s, const char *cpath, const struct cache_header *h) {
+    char tmp[PATH_MAX + 16];
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", cpath);
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        return;
+    }
+    FILE *fp = fdopen(fd, "w");
+    fwrite(h, sizeof(*h), 1, fp);
+    for (int i = 0; i < s->ncmds; i++) {
+        put_u32(fp, s->cmds[i].lineno);
+        put_str(fp, s->cmds[i].cmdline);
+        put_node(fp, s->cmds[i].command);
+    }
+    if (fclose(fp) != 0 || rename(tmp, cpath) < 0) {
+        unlink(tmp);
+    }
+}
+
+static uint32_t get_u32(struct cursor *c) {
+    uint32_t v = 0;
+    if (c->end - c->p < (ptrdiff_t)sizeof(v)) {
+        c->bad = 1;
+        return 0;
+    }
+    memcpy(&v, c->p, sizeof(v));
+    c->p += sizeof(v);
+    return v;
+}
+
+static int get_u8(struct cursor *c) {
+    if (c->p >= c->end) {
+        c->bad = 1;
+        return 0;
+    }
+    return (unsigned char)*c->p++;
+}
+
+/**
+ * get_str - 返回缓存中的字符串，不复制
+ */
+static char *get_str(struct cursor *c) {
+    uint32_t len = get_u32(c);
+    if (c->bad || (size_t)(c->end - c->p) <= len || c->p[len] != '\0') {
+        c->bad = 1;
+        return NULL;
+    }
+    char *str = c->p;
+    c->p += len + 1;
+    return str;
+}
+
+/**
+ * get_exec - 从缓存中重建 EXEC 结点，for 的单词可以为空，其余的不能
+ */
+static struct execcmd *get_exec(struct cursor *c, struct arena *a, int allow_empty) {
+    uint32_t argc = get_u32(c);
+    uint32_t nassign = get_u32(c);
+    unsigned char *expand = NULL;
+    if (c->bad || (argc == 0 && !allow_empty) || argc > (size_t)(c->end - c->p) || nassign > argc) {
+        c->bad = 1;
+        return NULL;
+    }
+    if (get_u8(c)) {
+        expand = (unsigned char *)arena_alloc(a, argc + 1);
+        for (uint32_t i = 0; i < argc; i++) {
+            expand[i] = get_u8(c);
+        }
+    }
+    char **argv = (char **)arena_alloc(a, (argc + 1) * sizeof(char *));
+    for (uint32_t i = 0; i < argc; i++) {
+        argv[i] = get_str(c);
+    }
+    argv[argc] = NULL;
+    struct execcmd *exec_cmd = (struct execcmd *)create_execcmd(a, argc, argv);
+    exec_cmd->nassign = nassign;
+    exec_cmd->expand = expand;
+    return exec_cmd;
+}
+
+/**
+ * get_node - 从缓存中重建命令树，结点从 a 中分配
+ */
+static struct cmd *get_node(struct cursor *c, struct arena *a) {
+    struct cmd *command = NULL;
+    int type = get_u8(c);
+    int fgbg = get_u8(c);
+
+    if (c->bad) {
+        return NULL;
+    }
+    switch (type) {
+        case EXEC:
+            command = (struct cmd *)get_exec(c, a, 0);
+            break;
+        case PIPE: {
+            struct cmd *left = get_node(c, a);
+            struct cmd *right = get_node(c, a);
+            command = create_pipecmd(a, left, right);
+            break;
+        }
+        case REDIR: {
+            int mode = get_u32(c);
+            int flags = get_u8(c);
+            int expand = get_u8(c);
+            char *in_file = flags & 1 ? get_str(c) : NULL;
+            char *out_file = flags & 2 ? get_str(c) : NULL;
+            command = create_redircmd(a, get_node(c, a), mode, in_file, out_file);
+            ((struct redircmd *)command)->expand = expand;
+            break;
+        }
+        case LIST: {
+            struct listcmd *list = create_listcmd(a);
+            uint32_t n = get_u32(c);
+            for (uint32_t i = 0; i < n && !c->bad; i++) {
+                char *cmdline = get_u8(c) ? get_str(c) : NULL;
+                list_add(a, list, get_node(c, a), cmdline);
+            }
+            command = (struct cmd *)list;
+            break;
+        }
+        case IF: {
+            struct cmd *cond = get_node(c, a);
+            struct cmd *then = get_node(c, a);
+            struct cmd *els = get_u8(c) ? get_node(c, a) : NULL;
+            command = create_ifcmd(a, cond, then, els);
+            break;
+        }
+        case WHILE: {
+            struct cmd *cond = get_node(c, a);
+            command = create_whilecmd(a, cond, get_node(c, a));
+            break;
+        }
+        case FOR: {
+            char *name = get_str(c);
+            struct execcmd *words = get_u8(c) ? get_exec(c, a, 1) : NULL;
+            command = create_forcmd(a, name, words, get_node(c, a));
+            break;
+        }
+        default:
+            c->bad = 1;
+            return NULL;
+    }
+    if (c->bad) {
+        return NULL;
+    }
+    command->fgbg = fgbg;
+    return command;
+}
+
+/**
+ * cache_load - 从缓存中载入编译的结果，缓存不存在、与脚本不符或者损坏时返回 -1。
+ * 缓存文件以可写的私有映射保留到 shell 退出，字符串直接指向其中
+ */
+static int cache_load(struct script *s, const char *cpath, const struct cache_header *want) {
+    struct stat st;
+    struct cache_header h;
+    int fd = open(cpath, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(h)) {
+        close(fd);
+        return -1;
+    }
+    char *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    memcpy(&h, map, sizeof(h));
+    if (memcmp(&h, want, offsetof(struct cache_header, ncmds)) != 0) {
+        munmap(map, st.st_size);
+        return -1;
+    }
+    struct cursor c = { map + sizeof(h), map + st.st_size, 0 };
+    for (uint32_t i = 0; i < h.ncmds && !c.bad; i++) {
+        int lineno = get_u32(&c);
+        char *cmdline = get_str(&c);
+        struct cmd *command = get_node(&c, s->arena);
+        add_cmd(s, lineno, cmdline, command);
+    }
+    if (c.bad || c.p != c.end) {
+        // 已经分配的结点留在内存池中，重新编译即可
+        s->ncmds = 0;
+        munmap(map, st.st_size);
+        return -1;
+    }
+    s->cache = map;
+    s->cachelen = st.st_size;
+    return 0;
+}
+
+/**
+ * 编译时读取脚本的位置，复合命令跨越多行时由 more_line 继续读入
+ */
+struct source {
+    struct reader *r;
+    int lineno;
+};
+
+/**
+ * more_line - 读入复合命令的下一行
+ */
+static const char *more_line(void *ctx) {
+    struct source *src = (struct source *)ctx;
+    size_t len;
+    STATS_START(t);
+    char *line = reader_getline(src->r, &len);
+    STATS_END(PH_READ, t);
+    if (line != NULL) {
+        src->lineno++;
+    }
+    return line;
+}
+
+/**
+ * compile - 逐行解析脚本，复合命令一直读到它结束为止，作为一条命令。
+ * 输出所有的语法错误，出错之后从下一行继续解析，返回语法错误的个数
+ */
+static int compile(struct script *s, struct reader *r, const char *path) {
+    struct arena *scratch = arena_new(0);   // 每一条命令的记号数组，解析完就不再需要
+    struct source src = { r, 0 };
+    const char *err;
+    size_t len;
+    int nerr = 0;
+
+    while (1) {
+        STATS_START(t);
+        char *line = reader_getline(r, &len);
+        STATS_END(PH_READ, t);
+        if (line == NULL) {
+            break;
+        }
+        int lineno = ++src.lineno;
+        // 读入复合命令之后的行时 line 可能失效，先复制一份作为命令行
+        char *cmdline = arena_strndup(s->arena, line, len);
+        err = NULL;
+        STATS_START(p);
+        struct cmd *command = parseline(s->arena, scratch, cmdline, more_line, &src, &err);
+        STATS_END(PH_PARSE, p);
+        arena_reset(scratch);
+        if (err != NULL) {
+            fprintf(stderr, "myshell: %s:%d: 语法错误: %s\n", path, src.lineno, err);
+            nerr++;
+        } else if (command != NULL) {
+            add_cmd(s, lineno, cmdline, command);
+        }
+    }
+    arena_free(scratch);
+    return nerr;
+}
+
+/**
+ * script_open - 将脚本映射到内存中并编译所有的行，在运行任何命令之前报告全部语法错误。
+ * 设置了 MYSHELL_CACHE 且脚本的修改时间、大小和内容的哈希值与缓存一致时，
+ * 直接从缓存中载入，不再解析。打开失败时返回 -1 并设置 errno，否则返回语法错误的个数
+ */
+int script_open(struct script *s, const char *path) {
+    static struct reader r;
+    struct cache_header h;
+    struct stat st;
+    char cpath[PATH_MAX];
+    int nerr = 0;
+
+    if (reader_open_file(&r, path) < 0) {
+        return -1;
+    }
+    uint64_t start = trace_enabled ? stats_now() : 0;
+    memset(s, 0, sizeof(*s));
+    s->arena = arena_new(r.maplen * 2);
+    // 只有映射到内存中的普通文件才能计算哈希值，管道等不使用缓存
+    int cached = r.map != NULL && stat(path, &st) == 0 && cache_path(path, cpath, sizeof(cpath)) == 0;
+    if (cached) {
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, CACHE_MAGIC, sizeof(h.magic));
+        h.mtime_sec = st.st_mtim.tv_sec;
+        h.mtime_nsec = st.st_mtim.tv_nsec;
+        h.size = st.st_size;
+        h.hash = fnv64(r.map, r.maplen);
+    }
+    if (cached && cache_load(s, cpath, &h) == 0) {
+        if (trace_enabled) {
+            trace_span("load cache", start, stats_now(), 0, 0, -1, path);
+        }
+    } else {
+        nerr = compile(s, &r, path);
+        if (cached && nerr == 0) {
+            h.ncmds = s->ncmds;
+            cache_write(s, cpath, &h);
+        }
+        if (trace_enabled) {
+            trace_span("compile", start, stats_now(), 0, 0, nerr, path);
+        }
+    }
+    reader_close(&r);
+    return nerr;
+}
+
+/**
+ * script_next - 取出下一条要运行的命令，没有更多命令时返回 NULL
+ */
+struct script_cmd *script_next(struct script *s) {
+    if (s->next >= s->ncmds) {
+        return NULL;
+    }
+    return &s->cmds[s->next++];
+}
@@ -0,0 +1,35 @@
+#ifndef __SCRIPT_H_
+#define __SCRIPT_H_
+
+#include <stddef.h>
+
+struct cmd;
+struct arena;
+
+/**
+ * 脚本中的一条命令，命令行和命令树都分配在脚本的内存池中
+ */
+struct script_cmd {
+    int lineno;
+    char *cmdline;
+    struct cmd *command;
+};
+
+/**
+ * 预先编译的脚本：运行之前解析所有行，运行时按顺序取出命令树，
+ * 不再有读入和解析的开销。空行不出现在 cmds 中
+ */
+struct script {
+    struct arena *arena;        // 所有命令的命令树和命令行，直到 shell 退出才释放
+    struct script_cmd *cmds;
+    int ncmds;
+    int cap;
+    int next;                   // 下一条要运行的命令
+    void *cache;                // 从缓存中载入时映射的缓存文件，字符串直接引用其中的内容
+    size_t cachelen;
+};
+
+int script_open(struct script *s, const char *path);
+struct script_cmd *script_next(struct script *s);
+
+#endif
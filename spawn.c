@@ -0,0 +1,204 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "spawn.h"
+
+enum spawn_mode spawn_mode = SPAWN_DEFAULT;   // 当前使用的进程创建方式
+
+static const char *mode_names[] = { "fork", "vfork", "posix_spawn" };
+
+/**
+ * spawn_mode_name - 返回创建方式的名字
+ */
+const char *spawn_mode_name(enum spawn_mode m) {
+    return mode_names[m];
+}
+
+/**
+ * spawn_init - 根据环境变量 MYSHELL_SPAWN 选择进程创建的方式，
+ * 可选值为 fork、vfork 和 posix_spawn，未设置时使用编译时的默认值
+ */
+void spawn_init(void) {
+    char *env = getenv("MYSHELL_SPAWN");
+    if (env == NULL || *env == '\0') {
+        return;
+    }
+    for (int i = SPAWN_FORK; i <= SPAWN_POSIX; i++) {
+        if (strcmp(env, mode_names[i]) == 0) {
+            spawn_mode = i;
+            return;
+        }
+    }
+    fprintf(stderr, "MYSHELL_SPAWN: 未知的方式 %s，使用 %s\n", env, mode_names[spawn_mode]);
+}
+
+/**
+ * spawn_redirect - 在子进程中设置标准输入输出，只使用系统调用，
+ * 因此可以在 vfork 的子进程中调用
+ */
+static int spawn_redirect(const struct spawn_io *io) {
+    int fd;
+    if (io->in_fd >= 0 && dup2(io->in_fd, 0) < 0) {
+        return -1;
+    }
+    if (io->out_fd >= 0 && dup2(io->out_fd, 1) < 0) {
+        return -1;
+    }
+    if (io->in_file && *io->in_file) {
+        if ((fd = open(io->in_file, O_RDONLY)) < 0) {
+            return -1;
+        }
+        if (fd != 0) {
+            dup2(fd, 0);
+            close(fd);
+        }
+    }
+    if (io->out_file && *io->out_file) {
+        if ((fd = open(io->out_file, io->out_flags, io->out_mode)) < 0) {
+            return -1;
+        }
+        if (fd != 1) {
+            dup2(fd, 1);
+            close(fd);
+        }
+    }
+    return 0;
+}
+
+/**
+ * spawn_posix - 使用 posix_spawn 创建子进程，重定向通过
+ * posix_spawn_file_actions 完成，进程组和信号掩码通过 posix_spawnattr 设置
+ */
+static pid_t spawn_posix(const char *path, char *const argv[], char *const envp[],
+                         const struct spawn_io *io, pid_t pgid, const sigset_t *child_mask) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    pid_t pid;
+    int err;
+
+    posix_spawn_file_actions_init(&actions);
+    if (io->in_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, io->in_fd, 0);
+    }
+    if (io->out_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, io->out_fd, 1);
+    }
+    if (io->in_file && *io->in_file) {
+        posix_spawn_file_actions_addopen(&actions, 0, io->in_file, O_RDONLY, 0);
+    }
+    if (io->out_file && *io->out_file) {
+        posix_spawn_file_actions_addopen(&actions, 1, io->out_file, io->out_flags, io->out_mode);
+    }
+
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK);
+    posix_spawnattr_setpgroup(&attr, pgid);
+    posix_spawnattr_setsigmask(&attr, child_mask);
+
+    err = posix_spawn(&pid, path, &actions, &attr, argv, envp);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return pid;
+}
+
+/**
+ * spawn_vfork - 使用 vfork 创建子进程，子进程与父进程共享内存，
+ * 因此 execve 失败时可以直接通过 err 变量将错误码传回父进程
+ */
+static pid_t spawn_vfork(const char *path, char *const argv[], char *const envp[],
+                         const struct spawn_io *io, pid_t pgid, const sigset_t *child_mask) {
+    volatile int err = 0;
+    pid_t pid;
+
+    if ((pid = vfork()) == 0) {
+        sigprocmask(SIG_SETMASK, child_mask, NULL);
+        setpgid(0, pgid);
+        if (spawn_redirect(io) == 0) {
+            execve(path, argv, envp);
+        }
+        err = errno;
+        _exit(127);
+    }
+    if (pid < 0) {
+        return -1;
+    }
+    if (err != 0) {     // 子进程已经退出，回收后报告错误
+        waitpid(pid, NULL, 0);
+        errno = err;
+        return -1;
+    }
+    return pid;
+}
+
+/**
+ * spawn_fork - 使用 fork 创建子进程，execve 失败时通过
+ * 带有 O_CLOEXEC 的管道将错误码传回父进程
+ */
+static pid_t spawn_fork(const char *path, char *const argv[], char *const envp[],
+                        const struct spawn_io *io, pid_t pgid, const sigset_t *child_mask) {
+    int errfds[2];
+    int err;
+    ssize_t n;
+    pid_t pid;
+
+    if (pipe2(errfds, O_CLOEXEC) < 0) {
+        return -1;
+    }
+    if ((pid = fork()) == 0) {
+        close(errfds[0]);
+        sigprocmask(SIG_SETMASK, child_mask, NULL);
+        setpgid(0, pgid);
+        if (spawn_redirect(io) == 0) {
+            execve(path, argv, envp);
+        }
+        err = errno;
+        write(errfds[1], &err, sizeof(err));
+        _exit(127);
+    }
+    close(errfds[1]);
+    if (pid < 0) {
+        close(errfds[0]);
+        return -1;
+    }
+    setpgid(pid, pgid ? pgid : pid);    // 父进程也设置一次，避免竞争
+    while ((n = read(errfds[0], &err, sizeof(err))) < 0 && errno == EINTR) {
+    }
+    close(errfds[0]);
+    if (n == sizeof(err)) {
+        waitpid(pid, NULL, 0);
+        errno = err;
+        return -1;
+    }
+    return pid;
+}
+
+/**
+ * spawn_exec - 按照 spawn_mode 创建子进程运行 path，参数为 argv，环境为 envp，
+ * pgid 为 0 时子进程成为新进程组的组长，否则加入进程组 pgid，
+ * child_mask 为子进程的信号掩码。
+ * 成功时返回子进程的 pid；失败时返回 -1，并设置 errno，此时不会留下子进程
+ */
+pid_t spawn_exec(const char *path, char *const argv[], char *const envp[],
+                 const struct spawn_io *io, pid_t pgid, const sigset_t *child_mask) {
+    switch (spawn_mode) {
+        case SPAWN_VFORK:
+            return spawn_vfork(path, argv, envp, io, pgid, child_mask);
+        case SPAWN_FORK:
+            return spawn_fork(path, argv, envp, io, pgid, child_mask);
+        case SPAWN_POSIX:
+        default:
+            return spawn_posix(path, argv, envp, io, pgid, child_mask);
+    }
+}
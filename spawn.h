@@ -0,0 +1,40 @@
+#ifndef __SPAWN_H_
+#define __SPAWN_H_
+
+#include <signal.h>
+#include <sys/types.h>
+
+/**
+ * 进程创建的方式：
+ * SPAWN_FORK  —— fork + execve，复制整个 shell 的页表
+ * SPAWN_VFORK —— vfork + execve，子进程与 shell 共享地址空间直到 execve
+ * SPAWN_POSIX —— posix_spawn，glibc 内部使用 CLONE_VM|CLONE_VFORK
+ */
+enum spawn_mode { SPAWN_FORK, SPAWN_VFORK, SPAWN_POSIX };
+
+/* 编译时可通过 -DSPAWN_DEFAULT=SPAWN_FORK 等选择默认的方式 */
+#ifndef SPAWN_DEFAULT
+#define SPAWN_DEFAULT SPAWN_POSIX
+#endif
+
+/**
+ * 子进程的输入输出设置，先处理 in_fd/out_fd（管道），
+ * 再处理 in_file/out_file（重定向），因此重定向优先于管道
+ */
+struct spawn_io {
+    int in_fd;              // 复制到标准输入的描述符，-1 表示不变
+    int out_fd;             // 复制到标准输出的描述符，-1 表示不变
+    const char *in_file;    // 输入重定向文件，NULL 或空串表示没有
+    const char *out_file;   // 输出重定向文件，NULL 或空串表示没有
+    int out_flags;          // 打开输出文件时的标志，追加或截断
+    mode_t out_mode;        // 创建输出文件时的权限
+};
+
+extern enum spawn_mode spawn_mode;
+
+void spawn_init(void);
+const char *spawn_mode_name(enum spawn_mode m);
+pid_t spawn_exec(const char *path, char *const argv[], char *const envp[],
+                 const struct spawn_io *io, pid_t pgid, const sigset_t *child_mask);
+
+#endif
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+#define NBUCKETS 64
+
+/**
+ * 一个阶段的耗时分布，第 i 个桶记录耗时在 [2^(i-1), 2^i) 纳秒之间的次数，
+ * 第 0 个桶记录耗时为 0 的次数
+ */
+struct histogram {
+    uint64_t buckets[NBUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+};
+
+static const char *phase_names[PH_NPHASES] = {
+    "read", "parse", "builtin", "spawn", "launch", "wait", "wakeup", "reap"
+};
+
+static struct histogram hists[PH_NPHASES];
+static pid_t stats_pid = 0;     // shell 的进程号，fork 出的子进程退出时不输出
+static char *dump_path = NULL;  // MYSHELL_STATS 的值
+
+/**
+ * stats_record - 将一次耗时 ns 记入阶段 phase 的直方图
+ */
+void stats_record(enum stats_phase phase, uint64_t ns) {
+    struct histogram *h = &hists[phase];
+    int b = ns ? 64 - __builtin_clzll(ns) : 0;
+    h->buckets[b]++;
+    h->count++;
+    h->sum += ns;
+    if (ns > h->max) {
+        h->max = ns;
+    }
+}
+
+/**
+ * stats_record_since - 将从 start 到现在的耗时记入阶段 phase，start 为 0 时不记录
+ */
+void stats_record_since(enum stats_phase phase, uint64_t start) {
+    uint64_t now = stats_now();
+    if (start != 0 && now >= start) {
+        stats_record(phase, now - start);
+    }
+}
+
+/**
+ * percentile - 返回第 p 百分位所在的桶的上界（纳秒），
+ * 直方图的精度为 2 倍，上界不超过记录到的最大值
+ */
+static uint64_t percentile(const struct histogram *h, int p) {
+    uint64_t rank = (h->count * p + 99) / 100, seen = 0;
+    for (int b = 0; b < NBUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= rank) {
+            uint64_t upper = b ? (uint64_t)1 << b : 0;
+            return upper < h->max ? upper : h->max;
+        }
+    }
+    return h->max;
+}
+
+/**
+ * stats_print - 按阶段输出次数、平均值、p50/p90/p99 和最大值，单位为微秒
+ */
+void stats_print(FILE *fp) {
+    fprintf(fp, "%-8s %8s %10s %10s %10s %10s %10s\n",
+            "phase", "count", "mean(us)", "p50(us)", "p90(us)", "p99(us)", "max(us)");
+    for (int i = 0; i < PH_NPHASES; i++) {
+        struct histogram *h = &hists[i];
+        if (h->count == 0) {
+            continue;
+        }
+        fprintf(fp, "%-8s %8lu %10.1f %10.1f %10.1f %10.1f %10.1f\n", phase_names[i],
+                (unsigned long)h->count, h->sum / 1e3 / h->count, percentile(h, 50) / 1e3,
+                percentile(h, 90) / 1e3, percentile(h, 99) / 1e3, h->max / 1e3);
+    }
+}
+
+/**
+ * stats_reset - 清空所有的直方图
+ */
+void stats_reset(void) {
+    memset(hists, 0, sizeof(hists));
+}
+
+/**
+ * stats_dump - 退出时输出直方图，MYSHELL_STATS 为 1 或 - 时输出到标准错误，
+ * 否则追加到以它为名字的文件中
+ */
+static void stats_dump(void) {
+    FILE *fp = stderr;
+    if (getpid() != stats_pid) {
+        return;
+    }
+    if (strcmp(dump_path, "1") != 0 && strcmp(dump_path, "-") != 0) {
+        if ((fp = fopen(dump_path, "a")) == NULL) {
+            perror(dump_path);
+            return;
+        }
+    }
+    stats_print(fp);
+    if (fp != stderr) {
+        fclose(fp);
+    }
+}
+
+/**
+ * stats_init - 设置了环境变量 MYSHELL_STATS 时，在 shell 退出时输出直方图
+ */
+void stats_init(void) {
+    char *env = getenv("MYSHELL_STATS");
+    if (env == NULL || *env == '\0') {
+        return;
+    }
+    dump_path = strdup(env);
+    stats_pid = getpid();
+    atexit(stats_dump);
+}
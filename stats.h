@@ -0,0 +1,60 @@
+#ifndef __STATS_H_
+#define __STATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * 主循环中被统计耗时的阶段
+ */
+enum stats_phase {
+    PH_READ,        // 从缓冲区中取出一行命令，不包括等待输入的时间
+    PH_PARSE,       // 词法和语法分析
+    PH_BUILTIN,     // 在 shell 中运行内部命令
+    PH_SPAWN,       // 创建管道中的一个进程（spawn_exec 或 fork）
+    PH_LAUNCH,      // 创建整个管道
+    PH_WAIT,        // 等待前台作业结束或者被停止的总时间，主要是作业自己运行的时间
+    PH_WAKEUP,      // 前台作业的最后一个进程被 wait4 回收到 waitfg 退出等待循环，不包括之后的清理
+    PH_REAP,        // 收到 SIGCHLD 之后回收子进程并更新作业表
+    PH_NPHASES
+};
+
+/*
+ * 编译时加上 -DNO_STATS 时，STATS_START 和 STATS_END 为空，没有任何开销；
+ * 否则每个阶段多两次 clock_gettime（通过 vDSO，不进入内核）
+ */
+#ifdef NO_STATS
+#define STATS_START(t)
+#define STATS_END(phase, t)
+#define STATS_AFTER(phase, t)
+#else
+#define STATS_START(t) uint64_t t = stats_now()
+#define STATS_END(phase, t) stats_record(phase, stats_now() - (t))
+// 起点为别处记录的时间 t（纳秒）的阶段，t 为 0 表示没有起点，这时不记录
+#define STATS_AFTER(phase, t) stats_record_since(phase, t)
+#endif
+
+/**
+ * ts_ns - 将 timespec 转换为纳秒
+ */
+static inline uint64_t ts_ns(const struct timespec *ts) {
+    return (uint64_t)ts->tv_sec * 1000000000u + ts->tv_nsec;
+}
+
+/**
+ * stats_now - 单调时钟的当前时间，以纳秒为单位
+ */
+static inline uint64_t stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts_ns(&ts);
+}
+
+void stats_init(void);
+void stats_record(enum stats_phase phase, uint64_t ns);
+void stats_record_since(enum stats_phase phase, uint64_t start);
+void stats_print(FILE *fp);
+void stats_reset(void);
+
+#endif
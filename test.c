@@ -0,0 +1,322 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "built_in_command.h"
+
+/*
+ * test 和 [ 的表达式求值，直接在参数上递归下降，不分配内存，也不创建进程。
+ * 参数不超过 4 个时按 POSIX 的规则由参数个数决定解释方式，否则使用完整的语法：
+ *   or      := and { -o and }
+ *   and     := not { -a not }
+ *   not     := ! not | primary
+ *   primary := ( or ) | 一元运算符 参数 | 参数 二元运算符 参数 | 参数
+ */
+
+/**
+ * 求值时的状态，按顺序读取参数
+ */
+struct test {
+    char **argv;
+    int n;              // 参数的个数，不包括命令名和 ]
+    int pos;
+    const char *err;    // 错误信息，NULL 表示没有错误
+};
+
+static int test_or(struct test *t);
+
+/**
+ * is_unary - 判断 s 是否为一元运算符
+ */
+static int is_unary(const char *s) {
+    return s[0] == '-' && s[1] != '\0' && s[2] == '\0' && strchr("bcdefghLnprsStuwxz", s[1]) != NULL;
+}
+
+/**
+ * is_binary - 判断 s 是否为二元运算符
+ */
+static int is_binary(const char *s) {
+    static const char *const ops[] = {
+        "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot", "-ef",
+    };
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (strcmp(s, ops[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * to_int - 将 s 转换为整数，允许前后的空白，不是整数时设置错误信息
+ */
+static long to_int(struct test *t, const char *s) {
+    char *end;
+    errno = 0;
+    long v = strtol(s, &end, 10);
+    while (*end == ' ' || *end == '\t') {
+        end++;
+    }
+    if (end == s || *end != '\0' || errno == ERANGE) {
+        static char buf[64];
+        snprintf(buf, sizeof(buf), "%.40s: 需要整数表达式", s);
+        t->err = buf;
+    }
+    return v;
+}
+
+/**
+ * unary - 计算一元运算 op arg，op 已经由 is_unary 检查
+ */
+static int unary(struct test *t, const char *op, const char *arg) {
+    struct stat st;
+    switch (op[1]) {
+        case 'n':
+            return *arg != '\0';
+        case 'z':
+            return *arg == '\0';
+        case 't':
+            return isatty(to_int(t, arg));
+        case 'r':
+            return access(arg, R_OK) == 0;
+        case 'w':
+            return access(arg, W_OK) == 0;
+        case 'x':
+            return access(arg, X_OK) == 0;
+        case 'L':
+        case 'h':
+            return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+    }
+    if (stat(arg, &st) < 0) {
+        return 0;
+    }
+    switch (op[1]) {
+        case 'b':
+            return S_ISBLK(st.st_mode);
+        case 'c':
+            return S_ISCHR(st.st_mode);
+        case 'd':
+            return S_ISDIR(st.st_mode);
+        case 'f':
+            return S_ISREG(st.st_mode);
+        case 'p':
+            return S_ISFIFO(st.st_mode);
+        case 'S':
+            return S_ISSOCK(st.st_mode);
+        case 's':
+            return st.st_size > 0;
+        case 'g':
+            return (st.st_mode & S_ISGID) != 0;
+        case 'u':
+            return (st.st_mode & S_ISUID) != 0;
+        default:    // -e
+            return 1;
+    }
+}
+
+/**
+ * newer - 判断文件 a 的修改时间是否晚于 b，b 不存在时 a 存在即为真
+ */
+static int newer(const char *a, const char *b) {
+    struct stat sa, sb;
+    if (stat(a, &sa) < 0) {
+        return 0;
+    }
+    if (stat(b, &sb) < 0) {
+        return 1;
+    }
+    return sa.st_mtim.tv_sec > sb.st_mtim.tv_sec ||
+           (sa.st_mtim.tv_sec == sb.st_mtim.tv_sec && sa.st_mtim.tv_nsec > sb.st_mtim.tv_nsec);
+}
+
+/**
+ * binary - 计算二元运算 a op b，op 已经由 is_binary 检查
+ */
+static int binary(struct test *t, const char *a, const char *op, const char *b) {
+    struct stat sa, sb;
+    if (op[0] != '-') {     // 字符串的比较
+        int cmp = strcmp(a, b);
+        switch (op[0]) {
+            case '=':
+                return cmp == 0;
+            case '!':
+                return cmp != 0;
+            case '<':
+                return cmp < 0;
+            default:
+                return cmp > 0;
+        }
+    }
+    if (strcmp(op, "-nt") == 0) {
+        return newer(a, b);
+    }
+    if (strcmp(op, "-ot") == 0) {
+        return newer(b, a);
+    }
+    if (strcmp(op, "-ef") == 0) {
+        return stat(a, &sa) == 0 && stat(b, &sb) == 0 && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+    }
+    long x = to_int(t, a);
+    long y = to_int(t, b);
+    switch (op[1] << 8 | op[2]) {
+        case 'e' << 8 | 'q':
+            return x == y;
+        case 'n' << 8 | 'e':
+            return x != y;
+        case 'l' << 8 | 't':
+            return x < y;
+        case 'l' << 8 | 'e':
+            return x <= y;
+        case 'g' << 8 | 't':
+            return x > y;
+        default:    // -ge
+            return x >= y;
+    }
+}
+
+/**
+ * test_primary - 括号中的表达式、一元运算、二元运算或者一个字符串
+ */
+static int test_primary(struct test *t) {
+    char **argv = t->argv + t->pos;
+    int left = t->n - t->pos;
+
+    if (left <= 0) {
+        t->err = "缺少参数";
+        return 0;
+    }
+    if (left >= 3 && is_binary(argv[1])) {
+        t->pos += 3;
+        return binary(t, argv[0], argv[1], argv[2]);
+    }
+    if (strcmp(argv[0], "(") == 0) {
+        t->pos++;
+        int v = test_or(t);
+        if (t->err == NULL && (t->pos >= t->n || strcmp(t->argv[t->pos], ")") != 0)) {
+            t->err = "缺少 )";
+        }
+        t->pos++;
+        return v;
+    }
+    if (left >= 2 && is_unary(argv[0])) {
+        t->pos += 2;
+        return unary(t, argv[0], argv[1]);
+    }
+    t->pos++;
+    return argv[0][0] != '\0';
+}
+
+static int test_not(struct test *t) {
+    if (t->pos < t->n && strcmp(t->argv[t->pos], "!") == 0) {
+        t->pos++;
+        return !test_not(t);
+    }
+    return test_primary(t);
+}
+
+static int test_and(struct test *t) {
+    int v = test_not(t);
+    while (t->err == NULL && t->pos < t->n && strcmp(t->argv[t->pos], "-a") == 0) {
+        t->pos++;
+        v = test_not(t) && v;   // 两边都要求值，以便报告错误
+    }
+    return v;
+}
+
+static int test_or(struct test *t) {
+    int v = test_and(t);
+    while (t->err == NULL && t->pos < t->n && strcmp(t->argv[t->pos], "-o") == 0) {
+        t->pos++;
+        v = test_and(t) || v;
+    }
+    return v;
+}
+
+/**
+ * test_posix - 参数不超过 4 个时按 POSIX 规定的方式求值，
+ * 这样 [ "$x" = y ] 在 $x 为 ! 或 ( 时也能得到正确的结果
+ */
+static int test_posix(struct test *t, char **argv, int n) {
+    switch (n) {
+        case 0:
+            return 0;
+        case 1:
+            return argv[0][0] != '\0';
+        case 2:
+            if (strcmp(argv[0], "!") == 0) {
+                return argv[1][0] == '\0';
+            }
+            if (is_unary(argv[0])) {
+                return unary(t, argv[0], argv[1]);
+            }
+            t->err = "需要一元运算符";
+            return 0;
+        case 3:
+            if (is_binary(argv[1])) {
+                return binary(t, argv[0], argv[1], argv[2]);
+            }
+            if (strcmp(argv[0], "!") == 0) {
+                return !test_posix(t, argv + 1, 2);
+            }
+            if (strcmp(argv[0], "(") == 0 && strcmp(argv[2], ")") == 0) {
+                return argv[1][0] != '\0';
+            }
+            break;
+        case 4:
+            if (strcmp(argv[0], "!") == 0) {
+                return !test_posix(t, argv + 1, 3);
+            }
+            if (strcmp(argv[0], "(") == 0 && strcmp(argv[3], ")") == 0) {
+                return test_posix(t, argv + 1, 2);
+            }
+            break;
+    }
+    // 其余的情况使用完整的语法
+    t->argv = argv;
+    t->n = n;
+    t->pos = 0;
+    int v = test_or(t);
+    if (t->err == NULL && t->pos < t->n) {
+        static char buf[64];
+        snprintf(buf, sizeof(buf), "%.40s: 多余的参数", t->argv[t->pos]);
+        t->err = buf;
+    }
+    return v;
+}
+
+/**
+ * test_eval - 求出 argv[0, n) 组成的表达式，返回 0 表示真，1 表示假，2 表示表达式错误
+ */
+static int test_eval(const char *name, char **argv, int n) {
+    struct test t = { argv, n, 0, NULL };
+    int v = test_posix(&t, argv, n);
+    if (t.err != NULL) {
+        fprintf(stderr, "%s: %s\n", name, t.err);
+        return 2;
+    }
+    return v ? 0 : 1;
+}
+
+/**
+ * test_imp - test 内部命令，求出参数组成的表达式，只通过退出状态返回结果：
+ * 0 为真，1 为假，2 为表达式错误。支持 ! -a -o 和括号，字符串的比较 = != < >，
+ * 整数的比较 -eq -ne -lt -le -gt -ge，文件的检查 -e -f -d -r -w -x -s -L 等
+ * 和文件的比较 -nt -ot -ef
+ */
+int test_imp(int argc, char *argv[]) {
+    return test_eval("test", argv + 1, argc - 1);
+}
+
+/**
+ * bracket_imp - [ 内部命令，与 test 相同，但最后一个参数必须为 ]
+ */
+int bracket_imp(int argc, char *argv[]) {
+    if (strcmp(argv[argc - 1], "]") != 0) {
+        fprintf(stderr, "[: 缺少 ]\n");
+        return 2;
+    }
+    return test_eval("[", argv + 1, argc - 2);
+}
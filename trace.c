@@ -0,0 +1,184 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define NEVENTS 256     // 环形缓冲区的大小，写满时一次写入文件
+#define CMDLEN 96       // 每个事件保存的命令的最大长度
+
+/**
+ * 一个 Chrome trace 的完整事件（ph 为 "X"），时间以纳秒为单位（CLOCK_MONOTONIC），
+ * name 为字符串常量或者指向 cmd。shell 自身的事件位于 shell 的进程号之下；管道中每一段的生命周期位于作业的
+ * 进程组号之下，线程号为该段的进程号，因此在查看器中每个作业占一行
+ */
+struct trace_event {
+    const char *name;
+    uint64_t start;
+    uint64_t end;
+    pid_t pid;      // 查看器中的进程号
+    pid_t tid;      // 查看器中的线程号
+    pid_t child;    // 相关的子进程，0 表示没有
+    pid_t pgid;     // 相关的进程组，0 表示没有
+    int status;     // 退出状态，-1 表示没有
+    char cmd[CMDLEN];
+};
+
+int trace_enabled = 0;
+static int trace_fd = -1;
+static pid_t trace_pid = 0;     // shell 的进程号，fork 出的子进程退出时不写入
+static struct trace_event events[NEVENTS];
+static int nevents = 0;
+static int nwritten = 0;        // 已经写入文件的事件数，用于决定是否需要逗号
+
+/**
+ * json_string - 将 s 转义为 JSON 字符串写入 out，返回写入的长度
+ */
+static int json_string(char *out, const char *s) {
+    char *p = out;
+    *p++ = '"';
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            *p++ = '\\';
+            *p++ = c;
+        } else if (c < 0x20) {
+            p += sprintf(p, "\\u%04x", c);
+        } else {
+            *p++ = c;
+        }
+    }
+    *p++ = '"';
+    return p - out;
+}
+
+/**
+ * write_all - 将 buf 中的 n 个字节全部写入 trace 文件
+ */
+static void write_all(const char *buf, size_t n) {
+    ssize_t w;
+    while (n > 0) {
+        if ((w = write(trace_fd, buf, n)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        buf += w;
+        n -= w;
+    }
+}
+
+/**
+ * trace_flush - 将缓冲区中的所有事件格式化后用一次 write 写入文件
+ */
+void trace_flush(void) {
+    // 每个事件最长约为 256 字节加上转义后的名字和命令
+    static char buf[NEVENTS * (256 + 2 * CMDLEN * 6)];
+    char *p = buf;
+    if (trace_fd < 0 || nevents == 0 || getpid() != trace_pid) {
+        return;
+    }
+    for (int i = 0; i < nevents; i++) {
+        struct trace_event *e = &events[i];
+        p += sprintf(p, "%s{\"name\":", nwritten++ ? ",\n" : "");
+        p += json_string(p, e->name);
+        p += sprintf(p, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{",
+                     e->start / 1e3, (e->end - e->start) / 1e3, e->pid, e->tid);
+        const char *sep = "";
+        if (e->child) {
+            p += sprintf(p, "\"pid\":%d", e->child);
+            sep = ",";
+        }
+        if (e->pgid) {
+            p += sprintf(p, "%s\"pgid\":%d", sep, e->pgid);
+            sep = ",";
+        }
+        if (e->status >= 0) {
+            p += sprintf(p, "%s\"status\":%d", sep, e->status);
+            sep = ",";
+        }
+        if (e->cmd[0]) {
+            p += sprintf(p, "%s\"cmd\":", sep);
+            p += json_string(p, e->cmd);
+        }
+        p += sprintf(p, "}}");
+    }
+    nevents = 0;
+    write_all(buf, p - buf);
+}
+
+/**
+ * trace_close - 退出时写入剩余的事件并结束 JSON 数组
+ */
+static void trace_close(void) {
+    if (getpid() != trace_pid) {
+        return;
+    }
+    trace_flush();
+    write_all("\n]\n", 3);
+    close(trace_fd);
+    trace_fd = -1;
+}
+
+/**
+ * add_event - 在环形缓冲区中取出一个事件，缓冲区写满时先写入文件
+ */
+static struct trace_event *add_event(const char *name, uint64_t start, uint64_t end) {
+    if (nevents == NEVENTS) {
+        trace_flush();
+    }
+    struct trace_event *e = &events[nevents++];
+    e->name = name;
+    e->start = start;
+    e->end = end;
+    return e;
+}
+
+/**
+ * trace_span - 记录 shell 自身的一个阶段，child、pgid 为 0、status 为 -1、cmd 为 NULL 时不输出
+ */
+void trace_span(const char *name, uint64_t start, uint64_t end, pid_t child, pid_t pgid,
+                int status, const char *cmd) {
+    struct trace_event *e = add_event(name, start, end);
+    e->pid = e->tid = trace_pid;
+    e->child = child;
+    e->pgid = pgid;
+    e->status = status;
+    snprintf(e->cmd, CMDLEN, "%s", cmd ? cmd : "");
+}
+
+/**
+ * trace_proc - 记录管道中一段的生命周期，从创建到被回收，事件的名字为命令名
+ */
+void trace_proc(const char *name, uint64_t start, uint64_t end, pid_t pid, pid_t pgid, int status) {
+    struct trace_event *e = add_event(NULL, start, end);
+    e->pid = pgid;
+    e->tid = pid;
+    e->child = pid;
+    e->pgid = pgid;
+    e->status = status;
+    snprintf(e->cmd, CMDLEN, "%s", name);
+    e->name = e->cmd;   // 命令名在作业删除后就会释放，因此保存一个副本
+}
+
+/**
+ * trace_init - 设置了 MYSHELL_TRACE 时，将事件以 Chrome trace 的 JSON 格式写入该文件
+ */
+void trace_init(void) {
+    char *path = getenv("MYSHELL_TRACE");
+    if (path == NULL || *path == '\0') {
+        return;
+    }
+    if ((trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+        fprintf(stderr, "MYSHELL_TRACE: %s: %s\n", path, strerror(errno));
+        return;
+    }
+    trace_pid = getpid();
+    trace_enabled = 1;
+    write_all("[\n", 2);
+    atexit(trace_close);
+}
@@ -0,0 +1,15 @@
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+extern int trace_enabled;   // 是否设置了 MYSHELL_TRACE，调用 trace_span 之前先检查
+
+void trace_init(void);
+void trace_span(const char *name, uint64_t start, uint64_t end, pid_t child, pid_t pgid,
+                int status, const char *cmd);
+void trace_proc(const char *name, uint64_t start, uint64_t end, pid_t pid, pid_t pgid, int status);
+void trace_flush(void);
+
+#endif
@@ -0,0 +1,322 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "var.h"
+
+#define INIT_VARS 64
+
+/**
+ * 变量表中的一项，str 为 NULL 表示空位。使用线性探测的开放寻址，
+ * 删除时向前移动后面的项，与作业表的进程号索引相同。
+ * 名字和值保存在同一个字符串 name=value 中，导出的变量可以直接放入 envp
+ */
+struct var {
+    char *str;          // "name=value"，由 malloc 分配
+    unsigned int hash;  // 名字的哈希值
+    int namelen;
+    int exported;       // 是否导出到子进程的环境中
+};
+
+static struct var *vartab = NULL;
+static int varcap = 0;
+static int nvars = 0;
+static int nexported = 0;
+
+static char **envp = NULL;          // 缓存的环境，元素直接指向导出的变量的 str
+static int envcap = 0;
+static unsigned long generation = 1;    // 每次修改导出的变量时增加
+static unsigned long envp_generation = 0;   // envp 对应的 generation
+
+static char **args = NULL;          // 位置参数，args[0] 为 $0
+static int nargs = 0;
+
+/**
+ * hash_name - 名字的前 len 个字符的 FNV-1a 哈希
+ */
+static unsigned int hash_name(const char *name, size_t len) {
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return h;
+}
+
+/**
+ * find - 返回名字为 name 的前 len 个字符的变量的位置，不存在时返回 -1
+ */
+static int find(const char *name, size_t len, unsigned int h) {
+    if (varcap == 0) {
+        return -1;
+    }
+    for (unsigned int i = h & (varcap - 1); vartab[i].str != NULL; i = (i + 1) & (varcap - 1)) {
+        if (vartab[i].hash == h && vartab[i].namelen == (int)len &&
+            memcmp(vartab[i].str, name, len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * insert - 将变量加入表中，调用者保证还有空位，返回其位置
+ */
+static int insert(char *str, unsigned int h, int namelen, int exported) {
+    unsigned int i = h & (varcap - 1);
+    while (vartab[i].str != NULL) {
+        i = (i + 1) & (varcap - 1);
+    }
+    vartab[i].str = str;
+    vartab[i].hash = h;
+    vartab[i].namelen = namelen;
+    vartab[i].exported = exported;
+    nvars++;
+    return i;
+}
+
+/**
+ * reserve - 保证表中还能放下一个变量，装载因子不超过 1/2
+ */
+static void reserve(void) {
+    struct var *old = vartab;
+    int oldcap = varcap;
+    if ((nvars + 1) * 2 <= varcap) {
+        return;
+    }
+    varcap = varcap ? varcap * 2 : INIT_VARS;
+    vartab = (struct var *)calloc(varcap, sizeof(struct var));
+    nvars = 0;
+    for (int i = 0; i < oldcap; i++) {
+        if (old[i].str != NULL) {
+            insert(old[i].str, old[i].hash, old[i].namelen, old[i].exported);
+        }
+    }
+    free(old);
+}
+
+/**
+ * remove_at - 删除位置 i 的变量，将探测序列中后面的项前移填补空位
+ */
+static void remove_at(int i) {
+    unsigned int j, k, mask = varcap - 1;
+    free(vartab[i].str);
+    nvars--;
+    for (j = i;;) {
+        vartab[i].str = NULL;
+        do {
+            j = (j + 1) & mask;
+            if (vartab[j].str == NULL) {
+                return;
+            }
+            k = vartab[j].hash & mask;
+            // k 在 (i, j] 中时，该项不能移动到 i
+        } while ((unsigned int)i <= j ? ((unsigned int)i < k && k <= j) : ((unsigned int)i < k || k <= j));
+        vartab[i] = vartab[j];
+        i = j;
+    }
+}
+
+/**
+ * make_str - 分配字符串 name=value
+ */
+static char *make_str(const char *name, size_t len, const char *value) {
+    size_t vlen = strlen(value);
+    char *str = (char *)malloc(len + vlen + 2);
+    memcpy(str, name, len);
+    str[len] = '=';
+    memcpy(str + len + 1, value, vlen + 1);
+    return str;
+}
+
+/**
+ * set - 设置变量的值，exported 为 1 时导出，为 -1 时保持原来的设置（新变量不导出）
+ */
+static void set(const char *name, size_t len, const char *value, int exported) {
+    unsigned int h = hash_name(name, len);
+    int i = find(name, len, h);
+    if (i < 0) {
+        reserve();
+        i = insert(NULL, h, len, 0);
+    }
+    struct var *v = &vartab[i];
+    if (value != NULL) {
+        free(v->str);
+        v->str = make_str(name, len, value);
+    } else if (v->str == NULL) {    // export name，name 原来不存在
+        v->str = make_str(name, len, "");
+    }
+    if (exported == 1 && !v->exported) {
+        v->exported = 1;
+        nexported++;
+    }
+    if (v->exported) {
+        generation++;
+    }
+}
+
+/**
+ * var_init - 将环境变量导入变量表，全部为导出的变量
+ */
+void var_init(char **env) {
+    for (int i = 0; env[i] != NULL; i++) {
+        const char *eq = strchr(env[i], '=');
+        if (eq != NULL) {
+            set(env[i], eq - env[i], eq + 1, 1);
+        }
+    }
+}
+
+/**
+ * var_get - 返回变量 name 的值，不存在时返回 NULL
+ */
+const char *var_get(const char *name) {
+    size_t len = strlen(name);
+    int i = find(name, len, hash_name(name, len));
+    return i >= 0 ? vartab[i].str + len + 1 : NULL;
+}
+
+/**
+ * var_set - 设置变量 name 的值，已经导出的变量仍然导出
+ */
+void var_set(const char *name, const char *value) {
+    set(name, strlen(name), value, -1);
+}
+
+/**
+ * var_export - 导出变量 name，value 不为 NULL 时同时设置它的值
+ */
+void var_export(const char *name, const char *value) {
+    set(name, strlen(name), value, 1);
+}
+
+/**
+ * var_assign - 执行赋值 name=value，word 中一定含有等号。exported 非零时同时导出
+ */
+void var_assign(const char *word, int exported) {
+    const char *eq = strchr(word, '=');
+    set(word, eq - word, eq + 1, exported ? 1 : -1);
+}
+
+/**
+ * var_unset - 删除变量 name
+ */
+void var_unset(const char *name) {
+    size_t len = strlen(name);
+    int i = find(name, len, hash_name(name, len));
+    if (i < 0) {
+        return;
+    }
+    if (vartab[i].exported) {
+        nexported--;
+        generation++;
+    }
+    remove_at(i);
+}
+
+static int compare_str(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * var_print - 按名字的顺序输出变量，exported 非零时只输出导出的变量，
+ * 格式为 export name=value，否则输出所有的变量，格式为 name=value
+ */
+void var_print(FILE *fp, int exported) {
+    char **list = (char **)malloc((nvars + 1) * sizeof(char *));
+    int n = 0;
+    for (int i = 0; i < varcap; i++) {
+        if (vartab[i].str != NULL && (!exported || vartab[i].exported)) {
+            list[n++] = vartab[i].str;
+        }
+    }
+    qsort(list, n, sizeof(char *), compare_str);
+    for (int i = 0; i < n; i++) {
+        fprintf(fp, "%s%s\n", exported ? "export " : "", list[i]);
+    }
+    free(list);
+}
+
+/**
+ * var_environ - 返回子进程的环境，以 NULL 结尾。只在导出的变量被修改之后才重新构造，
+ * 通常创建进程时不需要任何工作。返回的数组在下一次修改变量之前有效
+ */
+char **var_environ(void) {
+    if (envp_generation == generation) {
+        return envp;
+    }
+    if (nexported + 1 > envcap) {
+        envcap = (nexported + 1) * 2;
+        envp = (char **)realloc(envp, envcap * sizeof(char *));
+    }
+    int n = 0;
+    for (int i = 0; i < varcap; i++) {
+        if (vartab[i].str != NULL && vartab[i].exported) {
+            envp[n++] = vartab[i].str;
+        }
+    }
+    envp[n] = NULL;
+    envp_generation = generation;
+    return envp;
+}
+
+/**
+ * var_environ_with - 返回加上了 n 个赋值 assign（name=value）的环境，
+ * 用于 name=value cmd 这样只对一个命令有效的赋值。返回的数组由 malloc 分配，
+ * 其中的字符串引用 assign 和变量表，调用者创建进程之后释放数组
+ */
+char **var_environ_with(char **assign, int n) {
+    char **base = var_environ();
+    char **env = (char **)malloc((nexported + n + 1) * sizeof(char *));
+    int m = 0;
+    for (int i = 0; base[i] != NULL; i++) {
+        int j;
+        size_t len = strchr(base[i], '=') - base[i] + 1;
+        for (j = 0; j < n && strncmp(assign[j], base[i], len) != 0; j++) {
+        }
+        if (j == n) {   // 没有被覆盖
+            env[m++] = base[i];
+        }
+    }
+    for (int j = 0; j < n; j++) {
+        env[m++] = assign[j];
+    }
+    env[m] = NULL;
+    return env;
+}
+
+/**
+ * var_setargs - 设置位置参数，argv[0] 为 $0，argv 需要在 shell 运行期间一直有效
+ */
+void var_setargs(int argc, char *argv[]) {
+    args = argv;
+    nargs = argc;
+}
+
+/**
+ * var_arg - 返回第 i 个位置参数，不存在时返回 NULL
+ */
+const char *var_arg(int i) {
+    return i < nargs ? args[i] : NULL;
+}
+
+/**
+ * var_nargs - 返回位置参数的个数，不包括 $0
+ */
+int var_nargs(void) {
+    return nargs > 0 ? nargs - 1 : 0;
+}
+
+/**
+ * var_isname - 判断 s 的前 len 个字符是否为合法的变量名：字母或下划线开头，由字母、数字和下划线组成
+ */
+int var_isname(const char *s, size_t len) {
+    if (len == 0 || !(s[0] == '_' || (s[0] >= 'a' && s[0] <= 'z') || (s[0] >= 'A' && s[0] <= 'Z'))) {
+        return 0;
+    }
+    for (size_t i = 1; i < len; i++) {
+        if (!(s[i] == '_' || (s[i] >= 'a' && s[i] <= 'z') || (s[i] >= 'A' && s[i] <= 'Z') ||
+              (s[i] >= '0' && s[i] <= '9'))) {
+            return 0;
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,20 @@
+#ifndef __VAR_H_
+#define __VAR_H_
+
+#include <stdio.h>
+
+void var_init(char **env);
+const char *var_get(const char *name);
+void var_set(const char *name, const char *value);
+void var_export(const char *name, const char *value);
+void var_assign(const char *word, int exported);
+void var_unset(const char *name);
+void var_print(FILE *fp, int exported);
+char **var_environ(void);
+char **var_environ_with(char **assign, int n);
+void var_setargs(int argc, char *argv[]);
+const char *var_arg(int i);
+int var_nargs(void);
+int var_isname(const char *s, size_t len);
+
+#endif